@@ -87,6 +87,7 @@ nl_attribute_set_name(VALUE self, VALUE rb_name)
   if (status != LXB_STATUS_OK) {
     nl_raise_lexbor_error(status);
   }
+  nl_document_mutated(self);
 
   return rb_name;
 }
@@ -127,6 +128,7 @@ nl_attribute_set_value(VALUE self, VALUE rb_content)
   if (status != LXB_STATUS_OK) {
     nl_raise_lexbor_error(status);
   }
+  nl_document_mutated(self);
 
   return rb_content;
 }
@@ -0,0 +1,494 @@
+#include "nokolexbor.h"
+
+// Maximum number of translations kept per implied XPath context
+#define NL_CSS_XPATH_CACHE_SIZE 256
+
+extern VALUE mNokolexbor;
+VALUE mNokolexborCss;
+
+// { prefix => { selector => xpath or false } }
+static VALUE nl_css_xpath_cache = Qnil;
+
+static bool nl_css_xpath_complex(VALUE xpath, lxb_css_selector_list_t *list, const char *prefix);
+
+static bool
+nl_css_xpath_name_valid(const lexbor_str_t *name)
+{
+  if (name->data == NULL || name->length == 0) {
+    return false;
+  }
+  if (ISDIGIT(name->data[0]) || name->data[0] == '-' || name->data[0] == '.') {
+    return false;
+  }
+  for (size_t i = 0; i < name->length; i++) {
+    lxb_char_t c = name->data[i];
+    if (!ISALNUM(c) && c != '-' && c != '_' && c != '.' && c < 0x80) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void
+nl_css_xpath_append_name(VALUE xpath, const lexbor_str_t *name)
+{
+  rb_str_cat(xpath, (const char *)name->data, name->length);
+}
+
+/* Append +str+ as an XPath string literal, using concat() if it contains both quote characters. */
+static void
+nl_css_xpath_append_literal(VALUE xpath, const lexbor_str_t *str)
+{
+  const char *data = (const char *)str->data;
+  size_t length = str->data != NULL ? str->length : 0;
+
+  if (length == 0 || memchr(data, '\'', length) == NULL) {
+    rb_str_cat_cstr(xpath, "'");
+    rb_str_cat(xpath, data, length);
+    rb_str_cat_cstr(xpath, "'");
+    return;
+  }
+  if (memchr(data, '"', length) == NULL) {
+    rb_str_cat_cstr(xpath, "\"");
+    rb_str_cat(xpath, data, length);
+    rb_str_cat_cstr(xpath, "\"");
+    return;
+  }
+
+  rb_str_cat_cstr(xpath, "concat('");
+  for (size_t i = 0; i < length; i++) {
+    if (data[i] == '\'') {
+      rb_str_cat_cstr(xpath, "',\"'\",'");
+    } else {
+      rb_str_cat(xpath, &data[i], 1);
+    }
+  }
+  rb_str_cat_cstr(xpath, "')");
+}
+
+static bool
+nl_css_xpath_attribute(VALUE xpath, lxb_css_selector_t *selector)
+{
+  lxb_css_selector_attribute_t *attr = &selector->u.attribute;
+  const lexbor_str_t *name = &selector->name;
+
+  if (selector->ns.data != NULL || !nl_css_xpath_name_valid(name)) {
+    return false;
+  }
+  if (attr->modifier == LXB_CSS_SELECTOR_MODIFIER_I) {
+    return false;
+  }
+
+  if (attr->value.data == NULL) {
+    rb_str_cat_cstr(xpath, "@");
+    nl_css_xpath_append_name(xpath, name);
+    return true;
+  }
+
+  switch (attr->match) {
+  case LXB_CSS_SELECTOR_MATCH_EQUAL:
+    rb_str_cat_cstr(xpath, "@");
+    nl_css_xpath_append_name(xpath, name);
+    rb_str_cat_cstr(xpath, "=");
+    nl_css_xpath_append_literal(xpath, &attr->value);
+    break;
+
+  case LXB_CSS_SELECTOR_MATCH_INCLUDE:
+    rb_str_cat_cstr(xpath, "nokogiri-builtin:css-class(@");
+    nl_css_xpath_append_name(xpath, name);
+    rb_str_cat_cstr(xpath, ",");
+    nl_css_xpath_append_literal(xpath, &attr->value);
+    rb_str_cat_cstr(xpath, ")");
+    break;
+
+  case LXB_CSS_SELECTOR_MATCH_DASH:
+    rb_str_cat_cstr(xpath, "(@");
+    nl_css_xpath_append_name(xpath, name);
+    rb_str_cat_cstr(xpath, "=");
+    nl_css_xpath_append_literal(xpath, &attr->value);
+    rb_str_cat_cstr(xpath, " or starts-with(@");
+    nl_css_xpath_append_name(xpath, name);
+    rb_str_cat_cstr(xpath, ",concat(");
+    nl_css_xpath_append_literal(xpath, &attr->value);
+    rb_str_cat_cstr(xpath, ",'-')))");
+    break;
+
+  case LXB_CSS_SELECTOR_MATCH_PREFIX:
+    rb_str_cat_cstr(xpath, "starts-with(@");
+    nl_css_xpath_append_name(xpath, name);
+    rb_str_cat_cstr(xpath, ",");
+    nl_css_xpath_append_literal(xpath, &attr->value);
+    rb_str_cat_cstr(xpath, ")");
+    break;
+
+  case LXB_CSS_SELECTOR_MATCH_SUFFIX:
+    rb_str_cat_cstr(xpath, "substring(@");
+    nl_css_xpath_append_name(xpath, name);
+    rb_str_cat_cstr(xpath, ",string-length(@");
+    nl_css_xpath_append_name(xpath, name);
+    rb_str_cat_cstr(xpath, ")-string-length(");
+    nl_css_xpath_append_literal(xpath, &attr->value);
+    rb_str_cat_cstr(xpath, ")+1,string-length(");
+    nl_css_xpath_append_literal(xpath, &attr->value);
+    rb_str_cat_cstr(xpath, "))=");
+    nl_css_xpath_append_literal(xpath, &attr->value);
+    break;
+
+  case LXB_CSS_SELECTOR_MATCH_SUBSTRING:
+    rb_str_cat_cstr(xpath, "contains(@");
+    nl_css_xpath_append_name(xpath, name);
+    rb_str_cat_cstr(xpath, ",");
+    nl_css_xpath_append_literal(xpath, &attr->value);
+    rb_str_cat_cstr(xpath, ")");
+    break;
+
+  default:
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * Append the 1-based position of the context node among its siblings, or
+ * among its siblings of the same type when +element+ is given. Counting
+ * siblings keeps the condition correct on any axis, unlike position().
+ */
+static void
+nl_css_xpath_append_position(VALUE xpath, bool from_last, const lexbor_str_t *element)
+{
+  rb_str_cat_cstr(xpath, from_last ? "(count(following-sibling::" : "(count(preceding-sibling::");
+  if (element != NULL) {
+    nl_css_xpath_append_name(xpath, element);
+  } else {
+    rb_str_cat_cstr(xpath, "*");
+  }
+  rb_str_cat_cstr(xpath, ")+1)");
+}
+
+static bool
+nl_css_xpath_nth(VALUE xpath, lxb_css_selector_anb_of_t *anb_of, bool from_last, const lexbor_str_t *element)
+{
+  if (anb_of == NULL || anb_of->of != NULL) {
+    return false;
+  }
+
+  long a = anb_of->anb.a;
+  long b = anb_of->anb.b;
+  VALUE position = rb_str_buf_new(32);
+  nl_css_xpath_append_position(position, from_last, element);
+
+  if (a == 0) {
+    rb_str_catf(xpath, "%" PRIsVALUE "=%ld", position, b);
+  } else if (a > 0) {
+    // position >= b and (position - b) mod a = 0
+    rb_str_catf(xpath, "(%" PRIsVALUE ">=%ld and (%" PRIsVALUE "%c%ld) mod %ld=0)",
+                position, b, position, b < 0 ? '+' : '-', b < 0 ? -b : b, a);
+  } else {
+    // position <= b and (b - position) mod -a = 0
+    rb_str_catf(xpath, "(%" PRIsVALUE "<=%ld and (%ld-%" PRIsVALUE ") mod %ld=0)",
+                position, b, b, position, -a);
+  }
+
+  RB_GC_GUARD(position);
+  return true;
+}
+
+/* Append the compound selector at +*cursor+ as an XPath step and move +*cursor+ past it. */
+static bool
+nl_css_xpath_compound(VALUE xpath, lxb_css_selector_t **cursor)
+{
+  lxb_css_selector_t *selector = *cursor;
+  const lexbor_str_t *element = NULL;
+  VALUE conditions = rb_str_buf_new(0);
+
+  do {
+    if (selector->type == LXB_CSS_SELECTOR_TYPE_ELEMENT || selector->type == LXB_CSS_SELECTOR_TYPE_ANY) {
+      // Type selectors always lead a compound selector
+      if (selector != *cursor || selector->ns.data != NULL) {
+        return false;
+      }
+      if (selector->type == LXB_CSS_SELECTOR_TYPE_ELEMENT) {
+        if (!nl_css_xpath_name_valid(&selector->name)) {
+          return false;
+        }
+        element = &selector->name;
+      }
+      selector = selector->next;
+      continue;
+    }
+
+    if (RSTRING_LEN(conditions) > 0) {
+      rb_str_cat_cstr(conditions, " and ");
+    }
+
+    switch (selector->type) {
+    case LXB_CSS_SELECTOR_TYPE_ID:
+      rb_str_cat_cstr(conditions, "@id=");
+      nl_css_xpath_append_literal(conditions, &selector->name);
+      break;
+
+    case LXB_CSS_SELECTOR_TYPE_CLASS:
+      rb_str_cat_cstr(conditions, "nokogiri-builtin:css-class(@class,");
+      nl_css_xpath_append_literal(conditions, &selector->name);
+      rb_str_cat_cstr(conditions, ")");
+      break;
+
+    case LXB_CSS_SELECTOR_TYPE_ATTRIBUTE:
+      if (!nl_css_xpath_attribute(conditions, selector)) {
+        return false;
+      }
+      break;
+
+    case LXB_CSS_SELECTOR_TYPE_PSEUDO_CLASS:
+      switch (selector->u.pseudo.type) {
+      case LXB_CSS_SELECTOR_PSEUDO_CLASS_FIRST_CHILD:
+        rb_str_cat_cstr(conditions, "count(preceding-sibling::*)=0");
+        break;
+      case LXB_CSS_SELECTOR_PSEUDO_CLASS_LAST_CHILD:
+        rb_str_cat_cstr(conditions, "count(following-sibling::*)=0");
+        break;
+      case LXB_CSS_SELECTOR_PSEUDO_CLASS_ONLY_CHILD:
+        rb_str_cat_cstr(conditions, "count(preceding-sibling::*)=0 and count(following-sibling::*)=0");
+        break;
+      case LXB_CSS_SELECTOR_PSEUDO_CLASS_FIRST_OF_TYPE:
+      case LXB_CSS_SELECTOR_PSEUDO_CLASS_LAST_OF_TYPE:
+      case LXB_CSS_SELECTOR_PSEUDO_CLASS_ONLY_OF_TYPE:
+        if (element == NULL) {
+          return false;
+        }
+        if (selector->u.pseudo.type != LXB_CSS_SELECTOR_PSEUDO_CLASS_LAST_OF_TYPE) {
+          rb_str_cat_cstr(conditions, "count(preceding-sibling::");
+          nl_css_xpath_append_name(conditions, element);
+          rb_str_cat_cstr(conditions, ")=0");
+        }
+        if (selector->u.pseudo.type == LXB_CSS_SELECTOR_PSEUDO_CLASS_ONLY_OF_TYPE) {
+          rb_str_cat_cstr(conditions, " and ");
+        }
+        if (selector->u.pseudo.type != LXB_CSS_SELECTOR_PSEUDO_CLASS_FIRST_OF_TYPE) {
+          rb_str_cat_cstr(conditions, "count(following-sibling::");
+          nl_css_xpath_append_name(conditions, element);
+          rb_str_cat_cstr(conditions, ")=0");
+        }
+        break;
+      case LXB_CSS_SELECTOR_PSEUDO_CLASS_EMPTY:
+        rb_str_cat_cstr(conditions, "not(node())");
+        break;
+      case LXB_CSS_SELECTOR_PSEUDO_CLASS_ROOT:
+        rb_str_cat_cstr(conditions, "not(parent::*)");
+        break;
+      default:
+        return false;
+      }
+      break;
+
+    case LXB_CSS_SELECTOR_TYPE_PSEUDO_CLASS_FUNCTION:
+      switch (selector->u.pseudo.type) {
+      case LXB_CSS_SELECTOR_PSEUDO_CLASS_FUNCTION_NTH_CHILD:
+      case LXB_CSS_SELECTOR_PSEUDO_CLASS_FUNCTION_NTH_LAST_CHILD:
+        if (!nl_css_xpath_nth(conditions, selector->u.pseudo.data,
+                              selector->u.pseudo.type == LXB_CSS_SELECTOR_PSEUDO_CLASS_FUNCTION_NTH_LAST_CHILD, NULL)) {
+          return false;
+        }
+        break;
+      case LXB_CSS_SELECTOR_PSEUDO_CLASS_FUNCTION_NTH_OF_TYPE:
+      case LXB_CSS_SELECTOR_PSEUDO_CLASS_FUNCTION_NTH_LAST_OF_TYPE:
+        if (element == NULL ||
+            !nl_css_xpath_nth(conditions, selector->u.pseudo.data,
+                              selector->u.pseudo.type == LXB_CSS_SELECTOR_PSEUDO_CLASS_FUNCTION_NTH_LAST_OF_TYPE, element)) {
+          return false;
+        }
+        break;
+      case LXB_CSS_SELECTOR_PSEUDO_CLASS_FUNCTION_NOT: {
+        rb_str_cat_cstr(conditions, "not(");
+        for (lxb_css_selector_list_t *list = selector->u.pseudo.data; list != NULL; list = list->next) {
+          if (list != selector->u.pseudo.data) {
+            rb_str_cat_cstr(conditions, " or ");
+          }
+          // Only compound selectors can be expressed on the self axis
+          lxb_css_selector_t *inner = list->first;
+          if (inner == NULL || (inner->combinator != LXB_CSS_SELECTOR_COMBINATOR_DESCENDANT &&
+                                inner->combinator != LXB_CSS_SELECTOR_COMBINATOR_CLOSE)) {
+            return false;
+          }
+          rb_str_cat_cstr(conditions, "self::");
+          if (!nl_css_xpath_compound(conditions, &inner) || inner != NULL) {
+            return false;
+          }
+        }
+        rb_str_cat_cstr(conditions, ")");
+        break;
+      }
+      case LXB_CSS_SELECTOR_PSEUDO_CLASS_FUNCTION_HAS: {
+        rb_str_cat_cstr(conditions, "(");
+        for (lxb_css_selector_list_t *list = selector->u.pseudo.data; list != NULL; list = list->next) {
+          if (list != selector->u.pseudo.data) {
+            rb_str_cat_cstr(conditions, " or ");
+          }
+          if (!nl_css_xpath_complex(conditions, list, ".//")) {
+            return false;
+          }
+        }
+        rb_str_cat_cstr(conditions, ")");
+        break;
+      }
+      default:
+        return false;
+      }
+      break;
+
+    default:
+      return false;
+    }
+
+    selector = selector->next;
+  } while (selector != NULL && selector->combinator == LXB_CSS_SELECTOR_COMBINATOR_CLOSE);
+
+  if (element != NULL) {
+    nl_css_xpath_append_name(xpath, element);
+  } else {
+    rb_str_cat_cstr(xpath, "*");
+  }
+  if (RSTRING_LEN(conditions) > 0) {
+    rb_str_cat_cstr(xpath, "[");
+    rb_str_append(xpath, conditions);
+    rb_str_cat_cstr(xpath, "]");
+  }
+
+  *cursor = selector;
+  return true;
+}
+
+/* Append the complex selector +list+ as an XPath location path starting with +prefix+. */
+static bool
+nl_css_xpath_complex(VALUE xpath, lxb_css_selector_list_t *list, const char *prefix)
+{
+  lxb_css_selector_t *selector = list->first;
+  if (selector == NULL) {
+    return false;
+  }
+
+  switch (selector->combinator) {
+  case LXB_CSS_SELECTOR_COMBINATOR_DESCENDANT:
+  case LXB_CSS_SELECTOR_COMBINATOR_CLOSE:
+    rb_str_cat_cstr(xpath, prefix);
+    break;
+  case LXB_CSS_SELECTOR_COMBINATOR_CHILD:
+    // A leading '>' is relative to the node itself
+    if (strcmp(prefix, ".//") != 0) {
+      return false;
+    }
+    rb_str_cat_cstr(xpath, "./");
+    break;
+  default:
+    return false;
+  }
+
+  if (!nl_css_xpath_compound(xpath, &selector)) {
+    return false;
+  }
+
+  while (selector != NULL) {
+    switch (selector->combinator) {
+    case LXB_CSS_SELECTOR_COMBINATOR_DESCENDANT:
+      rb_str_cat_cstr(xpath, "//");
+      break;
+    case LXB_CSS_SELECTOR_COMBINATOR_CHILD:
+      rb_str_cat_cstr(xpath, "/");
+      break;
+    case LXB_CSS_SELECTOR_COMBINATOR_SIBLING:
+      rb_str_cat_cstr(xpath, "/following-sibling::*[1]/self::");
+      break;
+    case LXB_CSS_SELECTOR_COMBINATOR_FOLLOWING:
+      rb_str_cat_cstr(xpath, "/following-sibling::");
+      break;
+    default:
+      return false;
+    }
+
+    if (!nl_css_xpath_compound(xpath, &selector)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Translate the CSS +selector+ into an XPath expression, or return Qfalse if
+ * it can't be parsed by lexbor or uses syntax that isn't translated here.
+ */
+static VALUE
+nl_css_xpath_translate(VALUE selector, const char *prefix)
+{
+  lxb_status_t status;
+  lxb_css_selector_list_t *list = nl_css_selectors_parse((const lxb_char_t *)RSTRING_PTR(selector), RSTRING_LEN(selector), &status);
+  if (list == NULL) {
+    return Qfalse;
+  }
+
+  VALUE xpath = rb_str_buf_new(64);
+  bool translated = true;
+  for (lxb_css_selector_list_t *item = list; item != NULL && translated; item = item->next) {
+    if (item != list) {
+      rb_str_cat_cstr(xpath, " | ");
+    }
+    translated = nl_css_xpath_complex(xpath, item, prefix);
+  }
+
+  lxb_css_selector_list_destroy_memory(list);
+
+  return translated ? rb_obj_freeze(xpath) : Qfalse;
+}
+
+/*
+ * call-seq:
+ *   xpath_for(selector, prefix = ".//") -> String, nil
+ *
+ * Translate the CSS +selector+ into XPath, the way {Node#nokogiri_css} does,
+ * without loading Nokogiri. Every node test is prefixed with +prefix+.
+ *
+ * Translations are cached. Returns nil if the selector uses syntax that
+ * only Nokogiri understands, such as its XPath extensions.
+ *
+ * @example
+ *   Nokolexbor::CSS.xpath_for('ul > li.item')
+ *   # => ".//ul/li[nokogiri-builtin:css-class(@class,'item')]"
+ *
+ * @return [String, nil]
+ */
+static VALUE
+nl_css_xpath_for(int argc, VALUE *argv, VALUE self)
+{
+  VALUE selector, rb_prefix;
+  rb_scan_args(argc, argv, "11", &selector, &rb_prefix);
+
+  StringValue(selector);
+  rb_prefix = NIL_P(rb_prefix) ? rb_str_new_cstr(".//") : rb_String(rb_prefix);
+
+  VALUE cache = rb_hash_aref(nl_css_xpath_cache, rb_prefix);
+  if (NIL_P(cache)) {
+    cache = rb_hash_new();
+    rb_hash_aset(nl_css_xpath_cache, rb_str_new_frozen(rb_prefix), cache);
+  }
+
+  VALUE xpath = rb_hash_lookup2(cache, selector, Qundef);
+  if (xpath == Qundef) {
+    xpath = nl_css_xpath_translate(selector, StringValueCStr(rb_prefix));
+    if (RHASH_SIZE(cache) >= NL_CSS_XPATH_CACHE_SIZE) {
+      rb_hash_clear(cache);
+    }
+    rb_hash_aset(cache, selector, xpath);
+  }
+
+  return RTEST(xpath) ? xpath : Qnil;
+}
+
+void Init_nl_css_xpath(void)
+{
+  nl_css_xpath_cache = rb_hash_new();
+  rb_gc_register_address(&nl_css_xpath_cache);
+
+  mNokolexborCss = rb_define_module_under(mNokolexbor, "CSS");
+  rb_define_singleton_method(mNokolexborCss, "xpath_for", nl_css_xpath_for, -1);
+}
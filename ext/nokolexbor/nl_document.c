@@ -1,5 +1,17 @@
 #include "nokolexbor.h"
 #include "config.h"
+#include <ruby/atomic.h>
+#include <ruby/encoding.h>
+#include <ruby/thread.h>
+#include <lexbor/html/encoding.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 extern VALUE mNokolexbor;
 extern VALUE cNokolexborNode;
@@ -10,29 +22,217 @@ VALUE cNokolexborDocument;
 pthread_key_t p_key_html_parser;
 #endif
 
+// Inputs smaller than this are parsed while holding the GVL, releasing and
+// re-acquiring it costs more than parsing a small page.
+#define NL_PARSE_WITHOUT_GVL_THRESHOLD (64 * 1024)
+
+// Size of the UTF-8 chunks fed to the parser when transcoding.
+#define NL_TRANSCODE_CHUNK_SIZE (64 * 1024)
+
+// The selector of a key held by the cache is allocated right after it, that
+// of a lookup probe points into the selector String.
+typedef struct {
+  lxb_dom_node_t *node;
+  bool first;
+  size_t selector_len;
+  const lxb_char_t *selector;
+} nl_css_cache_key_t;
+
+static int
+nl_css_cache_key_compare(st_data_t a, st_data_t b)
+{
+  nl_css_cache_key_t *key_a = (nl_css_cache_key_t *)a;
+  nl_css_cache_key_t *key_b = (nl_css_cache_key_t *)b;
+  if (key_a->node != key_b->node || key_a->first != key_b->first || key_a->selector_len != key_b->selector_len) {
+    return 1;
+  }
+  return memcmp(key_a->selector, key_b->selector, key_a->selector_len) != 0;
+}
+
+static st_index_t
+nl_css_cache_key_hash(st_data_t data)
+{
+  nl_css_cache_key_t *key = (nl_css_cache_key_t *)data;
+  return st_hash(key->selector, key->selector_len, (st_index_t)(uintptr_t)key->node + key->first);
+}
+
+static const struct st_hash_type nl_css_cache_hash_type = {
+    nl_css_cache_key_compare,
+    nl_css_cache_key_hash,
+};
+
+static int
+free_css_cache_entry(st_data_t key, st_data_t value, st_data_t arg)
+{
+  ruby_xfree((void *)key);
+  lexbor_array_destroy((lexbor_array_t *)value, true);
+  return ST_DELETE;
+}
+
+static void
+nl_document_css_cache_clear(nl_document_t *doc)
+{
+  if (doc->css_cache != NULL) {
+    st_foreach(doc->css_cache, free_css_cache_entry, 0);
+  }
+  doc->css_cache_mutations = doc->mutations;
+}
+
+static void
+nl_parse_chunks_free(nl_parse_chunks_t *parse)
+{
+  ruby_xfree(parse->chunks);
+  ruby_xfree(parse);
+}
+
+static int
+mark_node_cache_entry(st_data_t key, st_data_t value, st_data_t arg)
+{
+  rb_gc_mark_movable((VALUE)value);
+  return ST_CONTINUE;
+}
+
+static void
+mark_nl_document(nl_document_t *doc)
+{
+  if (doc->parse != NULL) {
+    rb_gc_mark(doc->parse->rb_chunks);
+  }
+  if (doc->node_cache != NULL) {
+    st_foreach(doc->node_cache, mark_node_cache_entry, 0);
+  }
+}
+
+static int
+compact_node_cache_entry_check(st_data_t key, st_data_t value, st_data_t arg, int error)
+{
+  return (VALUE)value != rb_gc_location((VALUE)value) ? ST_REPLACE : ST_CONTINUE;
+}
+
+static int
+compact_node_cache_entry(st_data_t *key, st_data_t *value, st_data_t arg, int existing)
+{
+  *value = (st_data_t)rb_gc_location((VALUE)*value);
+  return ST_CONTINUE;
+}
+
+static void
+compact_nl_document(nl_document_t *doc)
+{
+  if (doc->node_cache != NULL) {
+    st_foreach_with_replace(doc->node_cache, compact_node_cache_entry_check, compact_node_cache_entry, 0);
+  }
+}
+
 static void
-free_nl_document(lxb_html_document_t *document)
+free_nl_document(nl_document_t *doc)
+{
+  if (doc->parse != NULL) {
+    nl_parse_chunks_free(doc->parse);
+  }
+  if (doc->css_cache != NULL) {
+    nl_document_css_cache_clear(doc);
+    st_free_table(doc->css_cache);
+  }
+  if (doc->node_cache != NULL) {
+    st_free_table(doc->node_cache);
+  }
+  if (doc->document != NULL) {
+    lxb_html_document_destroy(doc->document);
+  }
+  ruby_xfree(doc);
+}
+
+static size_t
+nl_mem_memsize(const lexbor_mem_t *mem)
+{
+  size_t size = 0;
+  if (mem != NULL) {
+    size += sizeof(lexbor_mem_t);
+    for (const lexbor_mem_chunk_t *chunk = mem->chunk_first; chunk != NULL; chunk = chunk->next) {
+      size += sizeof(lexbor_mem_chunk_t) + chunk->size;
+    }
+  }
+  return size;
+}
+
+static size_t
+nl_mraw_memsize(const lexbor_mraw_t *mraw)
+{
+  return mraw != NULL ? sizeof(lexbor_mraw_t) + nl_mem_memsize(mraw->mem) : 0;
+}
+
+static size_t
+nl_hash_memsize(const lexbor_hash_t *hash)
+{
+  if (hash == NULL) {
+    return 0;
+  }
+  size_t size = sizeof(lexbor_hash_t) + hash->table_size * sizeof(lexbor_hash_entry_t *);
+  if (hash->entries != NULL) {
+    size += sizeof(lexbor_dobject_t) + nl_mem_memsize(hash->entries->mem);
+  }
+  return size + nl_mraw_memsize(hash->mraw);
+}
+
+static int
+memsize_css_cache_entry(st_data_t key, st_data_t value, st_data_t arg)
+{
+  nl_css_cache_key_t *cache_key = (nl_css_cache_key_t *)key;
+  lexbor_array_t *array = (lexbor_array_t *)value;
+  *(size_t *)arg += sizeof(nl_css_cache_key_t) + cache_key->selector_len +
+                    sizeof(lexbor_array_t) + array->size * sizeof(void *);
+  return ST_CONTINUE;
+}
+
+/**
+ * Memory held by the document for ObjectSpace.memsize_of: the arenas its
+ * nodes and strings are allocated from, and the caches of the wrapper.
+ */
+static size_t
+memsize_nl_document(const nl_document_t *doc)
 {
-  lxb_html_document_destroy(document);
+  size_t size = sizeof(nl_document_t);
+  // The arenas may be growing on another thread while reparsing.
+  if (doc->document != NULL && !doc->reparsing) {
+    const lxb_dom_document_t *dom_document = &doc->document->dom_document;
+    size += sizeof(lxb_html_document_t);
+    size += nl_mraw_memsize(dom_document->mraw);
+    size += nl_mraw_memsize(dom_document->text);
+    size += nl_hash_memsize(dom_document->tags);
+    size += nl_hash_memsize(dom_document->attrs);
+    size += nl_hash_memsize(dom_document->prefix);
+    size += nl_hash_memsize(dom_document->ns);
+  }
+  if (doc->parse != NULL) {
+    size += sizeof(nl_parse_chunks_t) + doc->parse->capacity * sizeof(nl_parse_chunk_t);
+  }
+  if (doc->css_cache != NULL) {
+    size += st_memsize(doc->css_cache);
+    st_foreach(doc->css_cache, memsize_css_cache_entry, (st_data_t)&size);
+  }
+  if (doc->node_cache != NULL) {
+    size += st_memsize(doc->node_cache);
+  }
+  return size;
 }
 
 const rb_data_type_t nl_document_type = {
     "Nokolexbor::Document",
     {
-        0,
+        (RUBY_DATA_FUNC)mark_nl_document,
         (RUBY_DATA_FUNC)free_nl_document,
+        (size_t(*)(const void *))memsize_nl_document,
+        (RUBY_DATA_FUNC)compact_nl_document,
     },
     0,
     0,
     RUBY_TYPED_FREE_IMMEDIATELY,
 };
 
-static VALUE
-nl_document_parse_native(VALUE self, VALUE rb_html)
+static lxb_html_parser_t *
+nl_html_parser_get(void)
 {
-  const char *html_c = StringValuePtr(rb_html);
-  size_t html_len = RSTRING_LEN(rb_html);
-
 #ifdef HAVE_PTHREAD_H
   lxb_html_parser_t *html_parser = (lxb_html_parser_t *)pthread_getspecific(p_key_html_parser);
 #else
@@ -43,7 +243,6 @@ nl_document_parse_native(VALUE self, VALUE rb_html)
     lxb_status_t status = lxb_html_parser_init(html_parser);
     if (status != LXB_STATUS_OK) {
       lxb_html_parser_destroy(html_parser);
-      html_parser = NULL;
       nl_raise_lexbor_error(status);
     }
     html_parser->tree->scripting = true;
@@ -51,39 +250,1388 @@ nl_document_parse_native(VALUE self, VALUE rb_html)
     pthread_setspecific(p_key_html_parser, html_parser);
 #endif
   }
+  return html_parser;
+}
 
-  lxb_html_document_t *document = lxb_html_parse(html_parser, (const lxb_char_t *)html_c, html_len);
-
+static void
+nl_html_parser_release(lxb_html_parser_t *html_parser)
+{
 #ifndef HAVE_PTHREAD_H
   lxb_html_parser_destroy(html_parser);
 #endif
+}
 
-  if (document == NULL) {
-    rb_raise(rb_eRuntimeError, "Error parsing document");
+static bool
+nl_token_is_blank(const lxb_html_token_t *token)
+{
+  for (const lxb_char_t *c = token->text_start; c < token->text_end; c++) {
+    if (*c != ' ' && *c != '\t' && *c != '\n' && *c != '\f' && *c != '\r') {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Whitespace is content inside of these, also when nested in other elements */
+static bool
+nl_token_in_preformatted(lxb_html_tree_t *tree)
+{
+  lexbor_array_t *open_elements = tree->open_elements;
+  for (size_t i = open_elements->length; i > 0; i--) {
+    lxb_dom_node_t *node = (lxb_dom_node_t *)open_elements->list[i - 1];
+    if (node->ns != LXB_NS_HTML) {
+      continue;
+    }
+    switch (node->local_name) {
+    case LXB_TAG_PRE:
+    case LXB_TAG_LISTING:
+    case LXB_TAG_TEXTAREA:
+      return true;
+    default:
+      break;
+    }
+  }
+  return false;
+}
+
+static bool
+nl_token_filter_drops(nl_token_filter_t *filter, const lxb_html_token_t *token)
+{
+  if (token->tag_id == LXB_TAG__EM_COMMENT) {
+    return filter->options & NL_PARSE_SKIP_COMMENTS;
+  }
+  if (token->tag_id != LXB_TAG__TEXT) {
+    return false;
   }
 
-  return TypedData_Wrap_Struct(cNokolexborDocument, &nl_document_type, document);
+  lxb_dom_node_t *current = lxb_html_tree_current_node(filter->tree);
+  if (current != NULL && current->ns == LXB_NS_HTML
+      && (current->local_name == LXB_TAG_SCRIPT || current->local_name == LXB_TAG_STYLE)) {
+    return filter->options & NL_PARSE_SKIP_SCRIPT_CONTENT;
+  }
+  return (filter->options & NL_PARSE_SKIP_BLANK_TEXT) && nl_token_is_blank(token)
+         && !nl_token_in_preformatted(filter->tree);
 }
 
 /**
- * Create a new document.
+ * Tokenizer callback passing tokens on to the tree builder, except for those
+ * of the nodes skipped by the options of the filter.
+ */
+static lxb_html_token_t *
+nl_token_filter_callback(lxb_html_tokenizer_t *tkz, lxb_html_token_t *token, void *ctx)
+{
+  nl_token_filter_t *filter = (nl_token_filter_t *)ctx;
+  if (nl_token_filter_drops(filter, token)) {
+    return token;
+  }
+  return filter->callback(tkz, token, filter->ctx);
+}
+
+static void
+nl_token_filter_install(nl_token_filter_t *filter, lxb_html_parser_t *parser, int options)
+{
+  filter->options = options;
+  if (options == 0) {
+    return;
+  }
+  filter->tree = parser->tree;
+  filter->callback = parser->tkz->callback_token_done;
+  filter->ctx = parser->tkz->callback_token_ctx;
+  lxb_html_tokenizer_callback_token_done_set(parser->tkz, nl_token_filter_callback, filter);
+}
+
+static void
+nl_token_filter_remove(nl_token_filter_t *filter, lxb_html_parser_t *parser)
+{
+  if (filter->options != 0) {
+    lxb_html_tokenizer_callback_token_done_set(parser->tkz, filter->callback, filter->ctx);
+  }
+}
+
+typedef struct {
+  lxb_html_parser_t *html_parser;
+  const lxb_char_t *html;
+  size_t html_len;
+  /* Converter from the encoding of +html+ to UTF-8, NULL if it is UTF-8 */
+  rb_econv_t *ec;
+  int options;
+  lxb_html_document_t *document;
+  lxb_status_t status;
+} nl_parse_args_t;
+
+static bool
+nl_parse_chunk_location(nl_parse_chunks_t *parse, const lxb_char_t *data, size_t *location)
+{
+  for (size_t i = parse->length; i > 0; i--) {
+    nl_parse_chunk_t *chunk = &parse->chunks[i - 1];
+    if (data >= chunk->data && data <= chunk->data + chunk->length) {
+      *location = chunk->location + (data - chunk->data);
+      return true;
+    }
+  }
+  return false;
+}
+
+static size_t
+nl_parse_chunks_source_location(lxb_html_tokenizer_t *tkz, const lxb_char_t *data)
+{
+  nl_parse_chunks_t *parse = (nl_parse_chunks_t *)tkz->location_ctx;
+  size_t location;
+  if (data != NULL && nl_parse_chunk_location(parse, data, &location)) {
+    return location;
+  }
+  if (tkz->begin != NULL && nl_parse_chunk_location(parse, tkz->begin, &location)) {
+    return location;
+  }
+  return parse->length > 0 ? parse->chunks[parse->length - 1].location : 0;
+}
+
+/**
+ * @return The number of chunks at the start of +parse+ that the tokenizer
+ *         doesn't point into anymore, as they end before the current token.
+ */
+static size_t
+nl_parse_chunks_unused(nl_parse_chunks_t *parse, lxb_html_tokenizer_t *tkz)
+{
+  const lxb_char_t *token_begin = tkz->token != NULL ? tkz->token->begin : NULL;
+  for (size_t i = parse->length; i > 0; i--) {
+    nl_parse_chunk_t *chunk = &parse->chunks[i - 1];
+    if (token_begin >= chunk->data && token_begin <= chunk->data + chunk->length) {
+      return i - 1;
+    }
+  }
+  return parse->length;
+}
+
+static void
+nl_parse_chunks_drop(nl_parse_chunks_t *parse, size_t count)
+{
+  memmove(parse->chunks, parse->chunks + count, sizeof(nl_parse_chunk_t) * (parse->length - count));
+  parse->length -= count;
+}
+
+/**
+ * Decode +html+ with +ec+ into the parser, NL_TRANSCODE_CHUNK_SIZE bytes of
+ * UTF-8 at a time, and finish parsing. Source locations are offsets in the
+ * UTF-8 text, like for a document parsed with {#parse_chunk}.
  *
- * @return [Document]
+ * Doesn't need the GVL: rb_econv_convert only works on the state of +ec+
+ * and the buffers it is given, which are allocated like the nodes of lexbor.
+ */
+static lxb_status_t
+nl_parse_transcoded(lxb_html_parser_t *parser, rb_econv_t *ec, const lxb_char_t *html, size_t html_len)
+{
+  lxb_html_tokenizer_t *tkz = parser->tkz;
+  nl_parse_chunks_t parse = {0};
+  tkz->location_cb = nl_parse_chunks_source_location;
+  tkz->location_ctx = &parse;
+
+  const unsigned char *src = html;
+  const unsigned char *src_end = html + html_len;
+  rb_econv_result_t result = econv_finished;
+  lxb_status_t status = LXB_STATUS_OK;
+
+  do {
+    // The decoded chunks are freed once nothing points into them anymore.
+    size_t unused = nl_parse_chunks_unused(&parse, tkz);
+    for (size_t i = 0; i < unused; i++) {
+      lexbor_free((void *)parse.chunks[i].data);
+    }
+    nl_parse_chunks_drop(&parse, unused);
+
+    if (parse.length == parse.capacity) {
+      size_t capacity = parse.capacity == 0 ? 4 : parse.capacity * 2;
+      nl_parse_chunk_t *chunks = lexbor_realloc(parse.chunks, sizeof(nl_parse_chunk_t) * capacity);
+      if (chunks == NULL) {
+        status = LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        break;
+      }
+      parse.chunks = chunks;
+      parse.capacity = capacity;
+    }
+    lxb_char_t *buffer = lexbor_malloc(NL_TRANSCODE_CHUNK_SIZE);
+    if (buffer == NULL) {
+      status = LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+      break;
+    }
+
+    unsigned char *dst = buffer;
+    result = rb_econv_convert(ec, &src, src_end, &dst, buffer + NL_TRANSCODE_CHUNK_SIZE, 0);
+    nl_parse_chunk_t *chunk = &parse.chunks[parse.length++];
+    chunk->data = buffer;
+    chunk->length = dst - buffer;
+    chunk->location = parse.location;
+    parse.location += chunk->length;
+
+    if (chunk->length > 0) {
+      status = lxb_html_parse_chunk_process(parser, chunk->data, chunk->length);
+    }
+  } while (status == LXB_STATUS_OK && result == econv_destination_buffer_full);
+
+  if (status == LXB_STATUS_OK && result != econv_finished) {
+    status = LXB_STATUS_ERROR;
+  }
+  if (status == LXB_STATUS_OK) {
+    status = lxb_html_parse_chunk_end(parser);
+  }
+
+  tkz->location_cb = NULL;
+  tkz->location_ctx = NULL;
+  for (size_t i = 0; i < parse.length; i++) {
+    lexbor_free((void *)parse.chunks[i].data);
+  }
+  lexbor_free(parse.chunks);
+  return status;
+}
+
+static void *
+nl_document_parse_without_gvl(void *data)
+{
+  nl_parse_args_t *args = (nl_parse_args_t *)data;
+  lxb_html_parser_t *parser = args->html_parser;
+  bool recycled = args->document != NULL;
+
+  // The steps of lxb_html_parse(), which can also parse into a recycled
+  // document or decode the input on the way.
+  if (lxb_html_parser_state(parser) != LXB_HTML_PARSER_STATE_BEGIN) {
+    lxb_html_parser_clean(parser);
+  }
+  if (recycled) {
+    args->status = lxb_html_parse_chunk_prepare(parser, args->document);
+  } else {
+    args->document = lxb_html_parse_chunk_begin(parser);
+    args->status = args->document != NULL ? parser->status : LXB_STATUS_ERROR;
+  }
+
+  if (args->status == LXB_STATUS_OK) {
+    nl_token_filter_t filter;
+    nl_token_filter_install(&filter, parser, args->options);
+    if (args->ec != NULL) {
+      args->status = nl_parse_transcoded(parser, args->ec, args->html, args->html_len);
+    } else {
+      args->status = lxb_html_parse_chunk_process(parser, args->html, args->html_len);
+      if (args->status == LXB_STATUS_OK) {
+        args->status = lxb_html_parse_chunk_end(parser);
+      }
+    }
+    nl_token_filter_remove(&filter, parser);
+  }
+
+  if (args->status != LXB_STATUS_OK && !recycled && args->document != NULL) {
+    lxb_html_document_destroy(args->document);
+    args->document = NULL;
+  }
+  return NULL;
+}
+
+/**
+ * Parse +html+ into +rb_doc+, which must have been cleaned, or into a new
+ * document if +rb_doc+ is Qnil. +html+ is decoded with +ec+ unless it is
+ * NULL.
  */
 static VALUE
-nl_document_new(VALUE self)
+nl_document_parse_buffer(VALUE rb_doc, const lxb_char_t *html, size_t html_len, rb_econv_t *ec, int options)
+{
+  nl_document_t *doc;
+  if (NIL_P(rb_doc)) {
+    rb_doc = TypedData_Make_Struct(cNokolexborDocument, nl_document_t, &nl_document_type, doc);
+  } else {
+    doc = nl_rb_document_data_unwrap(rb_doc);
+  }
+
+  nl_parse_args_t args = {
+      .html_parser = nl_html_parser_get(),
+      .html = html,
+      .html_len = html_len,
+      .ec = ec,
+      .options = options,
+      .document = doc->document,
+  };
+
+  if (args.html_len >= NL_PARSE_WITHOUT_GVL_THRESHOLD) {
+    // lexbor allocates through ruby_xmalloc, which re-acquires the GVL by
+    // itself if it needs to trigger GC.
+    rb_thread_call_without_gvl(nl_document_parse_without_gvl, &args, NULL, NULL);
+  } else {
+    nl_document_parse_without_gvl(&args);
+  }
+
+  nl_html_parser_release(args.html_parser);
+
+  if (args.document == NULL) {
+    rb_raise(rb_eRuntimeError, "Error parsing document");
+  }
+  if (args.status != LXB_STATUS_OK) {
+    nl_raise_lexbor_error(args.status);
+  }
+  doc->document = args.document;
+
+  return rb_doc;
+}
+
+static lxb_html_parser_t *
+nl_document_chunk_parser(nl_document_t *doc)
 {
-  return nl_document_parse_native(self, rb_str_new("", 0));
+  return (lxb_html_parser_t *)doc->document->dom_document.parser;
 }
 
-lxb_dom_document_t *
-nl_rb_document_unwrap(VALUE rb_doc)
+static void
+nl_parse_chunks_push(nl_document_t *doc, VALUE rb_chunk)
 {
-  lxb_dom_document_t *doc;
-  TypedData_Get_Struct(rb_doc, lxb_dom_document_t, &nl_document_type, doc);
+  nl_parse_chunks_t *parse = doc->parse;
+  lxb_html_tokenizer_t *tkz = nl_document_chunk_parser(doc)->tkz;
+
+  // Forget the chunks before the one the current token began in, nothing
+  // points into them anymore.
+  size_t unused = nl_parse_chunks_unused(parse, tkz);
+  if (unused > 0) {
+    nl_parse_chunks_drop(parse, unused);
+    rb_ary_replace(parse->rb_chunks, rb_ary_subseq(parse->rb_chunks, unused, parse->length));
+  }
+
+  if (parse->length == parse->capacity) {
+    parse->capacity = parse->capacity == 0 ? 4 : parse->capacity * 2;
+    REALLOC_N(parse->chunks, nl_parse_chunk_t, parse->capacity);
+  }
+  nl_parse_chunk_t *chunk = &parse->chunks[parse->length++];
+  chunk->data = (const lxb_char_t *)RSTRING_PTR(rb_chunk);
+  chunk->length = RSTRING_LEN(rb_chunk);
+  chunk->location = parse->location;
+  parse->location += chunk->length;
+  rb_ary_push(parse->rb_chunks, rb_chunk);
+}
+
+static nl_document_t *
+nl_document_parsing_data_unwrap(VALUE self)
+{
+  nl_document_t *doc = nl_rb_document_data_unwrap(self);
+  if (doc->parse == NULL) {
+    rb_raise(rb_eRuntimeError, "Document is not being parsed");
+  }
   return doc;
 }
 
+static void
+nl_document_parse_chunk_start(nl_document_t *doc, int options)
+{
+  lxb_status_t status = lxb_html_document_parse_chunk_begin(doc->document);
+  if (status != LXB_STATUS_OK) {
+    nl_raise_lexbor_error(status);
+  }
+
+  doc->parse = ZALLOC(nl_parse_chunks_t);
+  doc->parse->rb_chunks = rb_ary_new();
+
+  lxb_html_parser_t *parser = nl_document_chunk_parser(doc);
+  parser->tree->scripting = true;
+  parser->tkz->location_cb = nl_parse_chunks_source_location;
+  parser->tkz->location_ctx = doc->parse;
+  nl_token_filter_install(&doc->parse->filter, parser, options);
+}
+
+static VALUE
+nl_document_parse_chunk_new(int options)
+{
+  nl_document_t *doc;
+  VALUE rb_doc = TypedData_Make_Struct(cNokolexborDocument, nl_document_t, &nl_document_type, doc);
+
+  doc->document = lxb_html_document_create();
+  if (doc->document == NULL) {
+    rb_raise(rb_eRuntimeError, "Error creating document");
+  }
+  nl_document_parse_chunk_start(doc, options);
+
+  return rb_doc;
+}
+
+/**
+ * call-seq:
+ *   parse_chunk_begin(skip = 0) -> Document
+ *
+ * Start parsing a document in chunks.
+ *
+ * @param skip [Integer] The nodes not to build, an OR of the SKIP_*
+ *   constants.
+ *
+ * @return [Document] An empty document, filled by {#parse_chunk}.
+ *
+ * @see PushParser
+ */
+static VALUE
+nl_document_parse_chunk_begin(int argc, VALUE *argv, VALUE self)
+{
+  VALUE rb_skip;
+  rb_scan_args(argc, argv, "01", &rb_skip);
+
+  return nl_document_parse_chunk_new(NIL_P(rb_skip) ? 0 : NUM2INT(rb_skip));
+}
+
+/**
+ * call-seq:
+ *   parse_chunk(html) -> Document
+ *
+ * Parse the next chunk of the HTML. A chunk may end anywhere, even in the
+ * middle of a tag or of a multibyte character.
+ *
+ * @return [Document] +self+
+ */
+static VALUE
+nl_document_parse_chunk(VALUE self, VALUE rb_html)
+{
+  nl_document_t *doc = nl_document_parsing_data_unwrap(self);
+
+  StringValue(rb_html);
+  if (RSTRING_LEN(rb_html) == 0) {
+    return self;
+  }
+  // The caller may reuse its buffer for the next chunk, while the tokenizer
+  // may still point into this one.
+  rb_html = rb_str_new_frozen(rb_html);
+  nl_parse_chunks_push(doc, rb_html);
+
+  lxb_status_t status = lxb_html_document_parse_chunk(doc->document, (const lxb_char_t *)RSTRING_PTR(rb_html), RSTRING_LEN(rb_html));
+  // The tree builder may move nodes already numbered, e.g. misnested ones.
+  nl_node_order_invalidate(&doc->document->dom_document);
+  nl_document_mutated(self);
+  if (status != LXB_STATUS_OK) {
+    nl_raise_lexbor_error(status);
+  }
+  return self;
+}
+
+/**
+ * Finish parsing a document started by {.parse_chunk_begin}, closing all
+ * elements left open.
+ *
+ * @return [Document] +self+
+ */
+static VALUE
+nl_document_parse_chunk_end(VALUE self)
+{
+  nl_document_t *doc = nl_document_parsing_data_unwrap(self);
+
+  lxb_status_t status = lxb_html_document_parse_chunk_end(doc->document);
+
+  // The parser is reused for fragments of this document, which are parsed in
+  // one piece.
+  lxb_html_parser_t *parser = nl_document_chunk_parser(doc);
+  parser->tkz->location_cb = NULL;
+  parser->tkz->location_ctx = NULL;
+  nl_token_filter_remove(&doc->parse->filter, parser);
+  nl_parse_chunks_free(doc->parse);
+  doc->parse = NULL;
+
+  nl_node_order_invalidate(&doc->document->dom_document);
+  nl_document_mutated(self);
+  if (status != LXB_STATUS_OK) {
+    nl_raise_lexbor_error(status);
+  }
+  return self;
+}
+
+/**
+ * @return [Boolean] true if this document is being parsed in chunks and
+ *   {#parse_chunk_end} hasn't been called yet.
+ */
+static VALUE
+nl_document_parsing_p(VALUE self)
+{
+  return nl_rb_document_data_unwrap(self)->parse != NULL ? Qtrue : Qfalse;
+}
+
+/**
+ * Get the elements the parser hasn't closed yet, from the outermost to the
+ * innermost.
+ *
+ * @return [NodeSet] Empty unless this document is being parsed in chunks.
+ */
+static VALUE
+nl_document_open_elements(VALUE self)
+{
+  nl_document_t *doc = nl_rb_document_data_unwrap(self);
+  lexbor_array_t *array = lexbor_array_create();
+
+  if (doc->parse != NULL) {
+    lexbor_array_t *open_elements = nl_document_chunk_parser(doc)->tree->open_elements;
+    for (size_t i = 0; i < open_elements->length; i++) {
+      lexbor_array_push(array, open_elements->list[i]);
+    }
+  }
+
+  return nl_rb_node_set_create_with_data(array, self);
+}
+
+/**
+ * @return [Boolean] true if +rb_doc+ is being parsed in chunks, the parser
+ *         then still refers to its open elements.
+ */
+bool
+nl_document_is_parsing(VALUE rb_doc)
+{
+  return rb_typeddata_is_kind_of(rb_doc, &nl_document_type) && nl_rb_document_data_unwrap(rb_doc)->parse != NULL;
+}
+
+// Encodings labels are resolved to, following the WHATWG Encoding Standard
+// which decodes these labels with a superset.
+static const char *const nl_encoding_supersets[][2] = {
+    {"US-ASCII", "Windows-1252"},
+    {"ISO-8859-1", "Windows-1252"},
+    {"Shift_JIS", "Windows-31J"},
+    {"EUC-KR", "CP949"},
+    {"GB2312", "GBK"},
+};
+
+static rb_encoding *
+nl_encoding_by_label(const lxb_char_t *label, size_t len)
+{
+  while (len > 0 && ISSPACE(*label)) {
+    label++;
+    len--;
+  }
+  while (len > 0 && ISSPACE(label[len - 1])) {
+    len--;
+  }
+
+  char name[64];
+  if (len == 0 || len >= sizeof(name)) {
+    return NULL;
+  }
+  memcpy(name, label, len);
+  name[len] = '\0';
+
+  rb_encoding *enc = rb_enc_find(name);
+  if (enc == NULL || rb_enc_dummy_p(enc)) {
+    return NULL;
+  }
+  for (size_t i = 0; i < sizeof(nl_encoding_supersets) / sizeof(nl_encoding_supersets[0]); i++) {
+    if (enc == rb_enc_find(nl_encoding_supersets[i][0])) {
+      rb_encoding *superset = rb_enc_find(nl_encoding_supersets[i][1]);
+      return superset != NULL ? superset : enc;
+    }
+  }
+  return enc;
+}
+
+/**
+ * @return The encoding given by a +hint+ such as an HTTP charset, or NULL
+ *         if +hint+ is nil or an unknown label.
+ */
+static rb_encoding *
+nl_encoding_hint(VALUE rb_hint)
+{
+  if (NIL_P(rb_hint)) {
+    return NULL;
+  }
+  if (rb_obj_is_kind_of(rb_hint, rb_cEncoding)) {
+    // Binary and US-ASCII are what bytes of unknown encoding are tagged with.
+    rb_encoding *enc = rb_to_encoding(rb_hint);
+    if (enc == rb_ascii8bit_encoding() || enc == rb_usascii_encoding() || rb_enc_dummy_p(enc)) {
+      return NULL;
+    }
+    return enc;
+  }
+  StringValue(rb_hint);
+  return nl_encoding_by_label((const lxb_char_t *)RSTRING_PTR(rb_hint), RSTRING_LEN(rb_hint));
+}
+
+/**
+ * @return The encoding +rb_str+ is tagged with, or NULL if it only holds
+ *         bytes.
+ */
+static rb_encoding *
+nl_encoding_of_string(VALUE rb_str)
+{
+  return nl_encoding_hint(rb_enc_from_encoding(rb_enc_get(rb_str)));
+}
+
+/**
+ * Determine the encoding of +html+ like the HTML Standard's encoding
+ * sniffing algorithm: a byte order mark, then the +hint+ of the transport
+ * layer, then <meta charset> within the first 1024 bytes, then UTF-8.
+ * Sets +bom_len+, unless NULL, to the length of the byte order mark, which
+ * isn't part of the content.
+ */
+static rb_encoding *
+nl_html_detect_encoding(const lxb_char_t *html, size_t html_len, rb_encoding *hint, size_t *bom_len)
+{
+  size_t bom_len_unused;
+  if (bom_len == NULL) {
+    bom_len = &bom_len_unused;
+  }
+  *bom_len = 0;
+  if (html_len >= 3 && html[0] == 0xEF && html[1] == 0xBB && html[2] == 0xBF) {
+    *bom_len = 3;
+    return rb_utf8_encoding();
+  }
+  if (html_len >= 2 && html[0] == 0xFE && html[1] == 0xFF) {
+    *bom_len = 2;
+    return rb_enc_find("UTF-16BE");
+  }
+  if (html_len >= 2 && html[0] == 0xFF && html[1] == 0xFE) {
+    *bom_len = 2;
+    return rb_enc_find("UTF-16LE");
+  }
+  if (hint != NULL) {
+    return hint;
+  }
+
+  rb_encoding *enc = NULL;
+  lxb_html_encoding_t em;
+  if (lxb_html_encoding_init(&em) == LXB_STATUS_OK) {
+    size_t prescan_len = html_len < 1024 ? html_len : 1024;
+    if (lxb_html_encoding_determine(&em, html, html + prescan_len) == LXB_STATUS_OK && lxb_html_encoding_meta_length(&em) > 0) {
+      lxb_html_encoding_entry_t *entry = lxb_html_encoding_meta_entry(&em, 0);
+      enc = nl_encoding_by_label(entry->name, entry->end - entry->name);
+    }
+    lxb_html_encoding_destroy(&em, false);
+  }
+
+  // A document that could be read as ASCII to find <meta> isn't UTF-16.
+  if (enc == NULL || enc == rb_enc_find("UTF-16LE") || enc == rb_enc_find("UTF-16BE")) {
+    return rb_utf8_encoding();
+  }
+  return enc;
+}
+
+/**
+ * call-seq:
+ *   detect_encoding(html, hint = nil) -> Encoding
+ *
+ * Determine the encoding of the bytes of +html+: a byte order mark wins over
+ * +hint+ (e.g. the charset of a Content-Type header), which wins over
+ * <meta charset> within the first 1024 bytes. Defaults to UTF-8.
+ *
+ * @param hint [Encoding, String, nil]
+ *
+ * @return [Encoding]
+ */
+static VALUE
+nl_document_detect_encoding(int argc, VALUE *argv, VALUE self)
+{
+  VALUE rb_html, rb_hint;
+  rb_scan_args(argc, argv, "11", &rb_html, &rb_hint);
+  StringValue(rb_html);
+  rb_encoding *enc = nl_html_detect_encoding((const lxb_char_t *)RSTRING_PTR(rb_html), RSTRING_LEN(rb_html), nl_encoding_hint(rb_hint), NULL);
+  return rb_enc_from_encoding(enc);
+}
+
+/**
+ * @return A converter from +enc+ to UTF-8, which replaces invalid bytes.
+ */
+static rb_econv_t *
+nl_econv_open_utf8(rb_encoding *enc)
+{
+  int ecflags = ECONV_INVALID_REPLACE | ECONV_UNDEF_REPLACE;
+  rb_econv_t *ec = rb_econv_open_opts(rb_enc_name(enc), "UTF-8", ecflags, Qnil);
+  if (ec == NULL) {
+    rb_exc_raise(rb_econv_open_exc(rb_enc_name(enc), "UTF-8", ecflags));
+  }
+  return ec;
+}
+
+typedef struct {
+  rb_econv_t *ec;
+  const lxb_char_t *html;
+  size_t html_len;
+  int options;
+  VALUE rb_doc;
+} nl_transcode_args_t;
+
+static VALUE
+nl_document_parse_transcoded(VALUE data)
+{
+  nl_transcode_args_t *args = (nl_transcode_args_t *)data;
+  return nl_document_parse_buffer(args->rb_doc, args->html, args->html_len, args->ec, args->options);
+}
+
+static VALUE
+nl_document_close_econv(VALUE data)
+{
+  rb_econv_close(((nl_transcode_args_t *)data)->ec);
+  return Qnil;
+}
+
+/**
+ * Parse +html+ in the encoding determined by {nl_html_detect_encoding}, into
+ * +rb_doc+ or a new document if +rb_doc+ is Qnil.
+ * Other encodings than UTF-8 are decoded a chunk at a time into the parser,
+ * rather than into a UTF-8 copy of the whole input, without the GVL for
+ * large inputs like UTF-8 ones.
+ */
+static VALUE
+nl_document_parse_encoded(VALUE rb_doc, const lxb_char_t *html, size_t html_len, rb_encoding *hint, int options)
+{
+  size_t bom_len;
+  rb_encoding *enc = nl_html_detect_encoding(html, html_len, hint, &bom_len);
+  html += bom_len;
+  html_len -= bom_len;
+  if (enc == rb_utf8_encoding()) {
+    return nl_document_parse_buffer(rb_doc, html, html_len, NULL, options);
+  }
+
+  nl_transcode_args_t args = {
+      .ec = nl_econv_open_utf8(enc),
+      .html = html,
+      .html_len = html_len,
+      .options = options,
+      .rb_doc = rb_doc,
+  };
+
+  return rb_ensure(nl_document_parse_transcoded, (VALUE)&args, nl_document_close_econv, (VALUE)&args);
+}
+
+static VALUE
+nl_document_parse_native(int argc, VALUE *argv, VALUE self)
+{
+  VALUE rb_html, rb_hint, rb_skip;
+  rb_scan_args(argc, argv, "12", &rb_html, &rb_hint, &rb_skip);
+
+  StringValue(rb_html);
+  rb_encoding *hint = nl_encoding_hint(rb_hint);
+  if (hint == NULL) {
+    hint = nl_encoding_of_string(rb_html);
+  }
+
+  // Parse from a frozen shared copy so that the buffer can't be modified or
+  // freed by another thread while the GVL is released.
+  VALUE rb_html_frozen = rb_str_new_frozen(rb_html);
+
+  int options = NIL_P(rb_skip) ? 0 : NUM2INT(rb_skip);
+  VALUE rb_doc = nl_document_parse_encoded(Qnil, (const lxb_char_t *)RSTRING_PTR(rb_html_frozen), RSTRING_LEN(rb_html_frozen), hint, options);
+  RB_GC_GUARD(rb_html_frozen);
+
+  return rb_doc;
+}
+
+static int
+nl_document_free_node_wrapper(st_data_t key, st_data_t value, st_data_t arg)
+{
+  ((nl_node_t *)RTYPEDDATA_DATA((VALUE)value))->node = NULL;
+  return ST_DELETE;
+}
+
+/**
+ * Make the wrappers of all nodes of +doc+ invalid, before the nodes are freed.
+ */
+static void
+nl_document_invalidate_nodes(nl_document_t *doc)
+{
+  if (doc->node_cache != NULL) {
+    st_foreach(doc->node_cache, nl_document_free_node_wrapper, 0);
+  }
+  doc->generation++;
+  doc->mutations++;
+}
+
+typedef struct {
+  VALUE rb_doc;
+  VALUE rb_html;
+  rb_encoding *hint;
+  int options;
+} nl_reparse_args_t;
+
+static VALUE
+nl_document_reparse_encoded(VALUE data)
+{
+  nl_reparse_args_t *args = (nl_reparse_args_t *)data;
+  return nl_document_parse_encoded(args->rb_doc, (const lxb_char_t *)RSTRING_PTR(args->rb_html), RSTRING_LEN(args->rb_html), args->hint, args->options);
+}
+
+static VALUE
+nl_document_reparse_done(VALUE data)
+{
+  ((nl_document_t *)data)->reparsing = false;
+  return Qnil;
+}
+
+/**
+ * call-seq:
+ *   reparse_native(html, encoding = nil, skip = 0) -> Document
+ *
+ * Replace the content of this document by +html+. The memory of the old
+ * nodes is reused for the new ones, so that existing {Node} and {NodeSet}
+ * objects of this document become invalid and raise when used. Other
+ * threads using the document while it is reparsed get a RuntimeError.
+ *
+ * @return [Document] +self+
+ */
+static VALUE
+nl_document_reparse_native(int argc, VALUE *argv, VALUE self)
+{
+  VALUE rb_html, rb_hint, rb_skip;
+  rb_scan_args(argc, argv, "12", &rb_html, &rb_hint, &rb_skip);
+
+  nl_document_t *doc = nl_rb_document_data_unwrap(self);
+  if (doc->parse != NULL) {
+    rb_raise(rb_eRuntimeError, "Cannot reparse a document while it is being parsed");
+  }
+  nl_rb_document_unwrap(self);
+
+  StringValue(rb_html);
+  rb_encoding *hint = nl_encoding_hint(rb_hint);
+  if (hint == NULL) {
+    hint = nl_encoding_of_string(rb_html);
+  }
+  int options = NIL_P(rb_skip) ? 0 : NUM2INT(rb_skip);
+  nl_reparse_args_t args = {
+      .rb_doc = self,
+      .rb_html = rb_str_new_frozen(rb_html),
+      .hint = hint,
+      .options = options,
+  };
+
+  nl_document_invalidate_nodes(doc);
+  // Frees all nodes but keeps the first block of each memory arena, the hash
+  // tables of names and the parser for the next parse.
+  lxb_html_document_clean(doc->document);
+  nl_node_order_invalidate(&doc->document->dom_document);
+
+  doc->reparsing = true;
+  rb_ensure(nl_document_reparse_encoded, (VALUE)&args, nl_document_reparse_done, (VALUE)doc);
+  RB_GC_GUARD(args.rb_html);
+
+  return self;
+}
+
+/**
+ * Free the native memory of this document now, rather than when it is
+ * garbage collected. The document and all its nodes can't be used anymore,
+ * they raise a RuntimeError when accessed.
+ *
+ * @return [nil]
+ *
+ * @see Nokolexbor.parse
+ */
+static VALUE
+nl_document_release(VALUE self)
+{
+  nl_document_t *doc = nl_rb_document_data_unwrap(self);
+  if (doc->document == NULL) {
+    return Qnil;
+  }
+  nl_rb_document_unwrap(self);
+
+  nl_document_invalidate_nodes(doc);
+  if (doc->css_cache != NULL) {
+    nl_document_css_cache_clear(doc);
+  }
+  if (doc->parse != NULL) {
+    nl_parse_chunks_free(doc->parse);
+    doc->parse = NULL;
+  }
+  lxb_html_document_destroy(doc->document);
+  doc->document = NULL;
+
+  return Qnil;
+}
+
+/**
+ * @return [Boolean] true if {#release!} has been called.
+ */
+static VALUE
+nl_document_released_p(VALUE self)
+{
+  return nl_rb_document_data_unwrap(self)->document == NULL ? Qtrue : Qfalse;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+typedef struct {
+  void *map;
+  size_t length;
+} nl_file_map_t;
+
+static VALUE
+nl_document_parse_file_map(VALUE data)
+{
+  nl_file_map_t *file_map = (nl_file_map_t *)data;
+  return nl_document_parse_encoded(Qnil, (const lxb_char_t *)file_map->map, file_map->length, NULL, 0);
+}
+
+static VALUE
+nl_document_unmap_file(VALUE data)
+{
+  nl_file_map_t *file_map = (nl_file_map_t *)data;
+  munmap(file_map->map, file_map->length);
+  return Qnil;
+}
+#endif
+
+/**
+ * call-seq:
+ *   parse_file(path) -> Document
+ *
+ * Parse the HTML file at +path+, its encoding is detected like for a binary
+ * String passed to {.parse}.
+ *
+ * Regular files are mapped into memory and parsed from there, without
+ * reading them into a String. The file must not be truncated while it is
+ * being parsed.
+ *
+ * @return [Document]
+ */
+static VALUE
+nl_document_parse_file(VALUE self, VALUE rb_path)
+{
+  FilePathValue(rb_path);
+#ifdef HAVE_SYS_MMAN_H
+  VALUE rb_ospath = rb_str_encode_ospath(rb_path);
+  int fd = rb_cloexec_open(StringValueCStr(rb_ospath), O_RDONLY, 0);
+  if (fd < 0) {
+    rb_sys_fail_str(rb_path);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int e = errno;
+    close(fd);
+    errno = e;
+    rb_sys_fail_str(rb_path);
+  }
+
+  // Pipes and devices can't be mapped, and empty files needn't be.
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    nl_file_map_t file_map = {
+        .map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0),
+        .length = (size_t)st.st_size,
+    };
+    int e = errno;
+    close(fd);
+    if (file_map.map == MAP_FAILED) {
+      errno = e;
+      rb_sys_fail_str(rb_path);
+    }
+    return rb_ensure(nl_document_parse_file_map, (VALUE)&file_map, nl_document_unmap_file, (VALUE)&file_map);
+  }
+  close(fd);
+#endif
+  VALUE rb_html = rb_funcall(rb_cFile, rb_intern("binread"), 1, rb_path);
+  return nl_document_parse_native(1, &rb_html, self);
+}
+
+typedef struct {
+  VALUE rb_htmls;
+  size_t threads;
+  size_t length;
+  const lxb_char_t **htmls;
+  size_t *html_lens;
+  // Copies of embedded strings, whose content may be moved by GC compaction
+  // while the GVL is released.
+  lxb_char_t **html_copies;
+  // Converters of the inputs not in UTF-8, decoded by the workers
+  rb_econv_t **ecs;
+  // Parsed documents not yet owned by a Ruby Document
+  lxb_html_document_t **documents;
+  // Index of the next document to parse, shared by the workers
+  size_t next;
+  volatile int cancelled;
+  VALUE rb_workers;
+} nl_parse_many_t;
+
+typedef struct {
+  nl_parse_many_t *batch;
+  lxb_html_parser_t *html_parser;
+} nl_parse_many_worker_t;
+
+static void *
+nl_parse_many_without_gvl(void *data)
+{
+  nl_parse_many_worker_t *worker = (nl_parse_many_worker_t *)data;
+  nl_parse_many_t *batch = worker->batch;
+
+  while (!batch->cancelled) {
+    size_t i = RUBY_ATOMIC_SIZE_FETCH_ADD(batch->next, 1);
+    if (i >= batch->length) {
+      break;
+    }
+    nl_parse_args_t args = {
+        .html_parser = worker->html_parser,
+        .html = batch->htmls[i],
+        .html_len = batch->html_lens[i],
+        .ec = batch->ecs[i],
+    };
+    nl_document_parse_without_gvl(&args);
+    batch->documents[i] = args.document;
+  }
+  return NULL;
+}
+
+static void
+nl_parse_many_cancel(void *data)
+{
+  ((nl_parse_many_worker_t *)data)->batch->cancelled = 1;
+}
+
+static VALUE
+nl_parse_many_work_protected(VALUE data)
+{
+  nl_parse_many_worker_t worker = {
+      .batch = (nl_parse_many_t *)data,
+      .html_parser = nl_html_parser_get(),
+  };
+  rb_thread_call_without_gvl(nl_parse_many_without_gvl, &worker, nl_parse_many_cancel, &worker);
+  nl_html_parser_release(worker.html_parser);
+  return Qnil;
+}
+
+static VALUE
+nl_parse_many_work(void *data)
+{
+  // Documents a worker failed to parse are left NULL and reported by the
+  // calling thread, joining a worker never raises.
+  int state = 0;
+  rb_protect(nl_parse_many_work_protected, (VALUE)data, &state);
+  return Qnil;
+}
+
+static VALUE
+nl_parse_many_run(VALUE data)
+{
+  nl_parse_many_t *batch = (nl_parse_many_t *)data;
+
+  batch->htmls = ALLOC_N(const lxb_char_t *, batch->length);
+  batch->html_lens = ALLOC_N(size_t, batch->length);
+  batch->html_copies = ZALLOC_N(lxb_char_t *, batch->length);
+  batch->ecs = ZALLOC_N(rb_econv_t *, batch->length);
+  batch->documents = ZALLOC_N(lxb_html_document_t *, batch->length);
+
+  VALUE rb_frozen_htmls = rb_ary_new_capa(batch->length);
+  for (size_t i = 0; i < batch->length; i++) {
+    VALUE rb_html = rb_ary_entry(batch->rb_htmls, i);
+    StringValue(rb_html);
+    rb_html = rb_str_new_frozen(rb_html);
+    rb_ary_push(rb_frozen_htmls, rb_html);
+
+    size_t bom_len;
+    rb_encoding *enc = nl_html_detect_encoding((const lxb_char_t *)RSTRING_PTR(rb_html), RSTRING_LEN(rb_html),
+                                               nl_encoding_of_string(rb_html), &bom_len);
+    batch->htmls[i] = (const lxb_char_t *)RSTRING_PTR(rb_html) + bom_len;
+    batch->html_lens[i] = RSTRING_LEN(rb_html) - bom_len;
+    if (enc != rb_utf8_encoding()) {
+      batch->ecs[i] = nl_econv_open_utf8(enc);
+    }
+    if (!FL_TEST_RAW(rb_html, RSTRING_NOEMBED)) {
+      batch->html_copies[i] = ALLOC_N(lxb_char_t, batch->html_lens[i] + 1);
+      memcpy(batch->html_copies[i], batch->htmls[i], batch->html_lens[i]);
+      batch->htmls[i] = batch->html_copies[i];
+    }
+  }
+
+  for (size_t i = 1; i < batch->threads; i++) {
+    rb_ary_push(batch->rb_workers, rb_thread_create(nl_parse_many_work, batch));
+  }
+  // The calling thread takes part as well, interrupts of it must propagate.
+  nl_parse_many_work_protected((VALUE)batch);
+  for (long i = 0; i < RARRAY_LEN(batch->rb_workers); i++) {
+    rb_funcall(rb_ary_entry(batch->rb_workers, i), rb_intern("join"), 0);
+  }
+  RB_GC_GUARD(rb_frozen_htmls);
+
+  VALUE rb_docs = rb_ary_new_capa(batch->length);
+  for (size_t i = 0; i < batch->length; i++) {
+    if (batch->documents[i] == NULL) {
+      rb_raise(rb_eRuntimeError, "Error parsing document");
+    }
+    nl_document_t *doc;
+    VALUE rb_doc = TypedData_Make_Struct(cNokolexborDocument, nl_document_t, &nl_document_type, doc);
+    doc->document = batch->documents[i];
+    batch->documents[i] = NULL;
+    rb_ary_push(rb_docs, rb_doc);
+  }
+  return rb_docs;
+}
+
+static VALUE
+nl_parse_many_join(VALUE rb_worker)
+{
+  return rb_funcall(rb_worker, rb_intern("join"), 0);
+}
+
+static VALUE
+nl_parse_many_cleanup(VALUE data)
+{
+  nl_parse_many_t *batch = (nl_parse_many_t *)data;
+
+  // Workers refer to +batch+, make sure all of them are gone before it is
+  // freed, even if joining is interrupted.
+  batch->cancelled = 1;
+  int interrupted = 0;
+  for (long i = 0; i < RARRAY_LEN(batch->rb_workers); i++) {
+    int state;
+    while (rb_protect(nl_parse_many_join, rb_ary_entry(batch->rb_workers, i), &state), state != 0) {
+      interrupted = state;
+    }
+  }
+
+  for (size_t i = 0; i < batch->length; i++) {
+    if (batch->documents != NULL && batch->documents[i] != NULL) {
+      lxb_html_document_destroy(batch->documents[i]);
+    }
+    if (batch->html_copies != NULL) {
+      ruby_xfree(batch->html_copies[i]);
+    }
+    if (batch->ecs != NULL && batch->ecs[i] != NULL) {
+      rb_econv_close(batch->ecs[i]);
+    }
+  }
+  ruby_xfree(batch->htmls);
+  ruby_xfree(batch->html_lens);
+  ruby_xfree(batch->html_copies);
+  ruby_xfree(batch->ecs);
+  ruby_xfree(batch->documents);
+
+  if (interrupted) {
+    rb_jump_tag(interrupted);
+  }
+  return Qnil;
+}
+
+/**
+ * call-seq:
+ *   parse_many_native(htmls, threads) -> Array<Document>
+ *
+ * Parse every String of +htmls+ on up to +threads+ threads, which release
+ * the GVL while parsing. The encoding of each String is detected like in
+ * {.parse}, and other encodings than UTF-8 are decoded by the threads.
+ *
+ * @return [Array<Document>] The documents, in the order of +htmls+.
+ */
+static VALUE
+nl_document_parse_many_native(VALUE self, VALUE rb_htmls, VALUE rb_threads)
+{
+  Check_Type(rb_htmls, T_ARRAY);
+  long threads = NUM2LONG(rb_threads);
+  if (threads < 1) {
+    rb_raise(rb_eArgError, "threads must be positive, got %ld", threads);
+  }
+
+  nl_parse_many_t batch = {
+      .rb_htmls = rb_htmls,
+      .length = RARRAY_LEN(rb_htmls),
+      .rb_workers = rb_ary_new(),
+  };
+  batch.threads = (size_t)threads < batch.length ? (size_t)threads : batch.length;
+
+  VALUE rb_docs = rb_ensure(nl_parse_many_run, (VALUE)&batch, nl_parse_many_cleanup, (VALUE)&batch);
+  RB_GC_GUARD(batch.rb_htmls);
+  RB_GC_GUARD(batch.rb_workers);
+  return rb_docs;
+}
+
+/**
+ * Create a new document.
+ *
+ * @return [Document]
+ */
+static VALUE
+nl_document_new(VALUE self)
+{
+  return nl_document_parse_buffer(Qnil, (const lxb_char_t *)"", 0, NULL, 0);
+}
+
+nl_document_t *
+nl_rb_document_data_unwrap(VALUE rb_doc)
+{
+  nl_document_t *doc;
+  TypedData_Get_Struct(rb_doc, nl_document_t, &nl_document_type, doc);
+  return doc;
+}
+
+lxb_dom_document_t *
+nl_rb_document_unwrap(VALUE rb_doc)
+{
+  nl_document_t *doc = nl_rb_document_data_unwrap(rb_doc);
+  if (doc->document == NULL) {
+    rb_raise(rb_eRuntimeError, "Document has been released");
+  }
+  if (doc->reparsing) {
+    rb_raise(rb_eRuntimeError, "Document is being reparsed");
+  }
+  return &doc->document->dom_document;
+}
+
+/**
+ * Record that the tree of the document owning +rb_node_or_doc+ has changed,
+ * this invalidates memoized query results.
+ */
+void
+nl_document_mutated(VALUE rb_node_or_doc)
+{
+  VALUE rb_doc = nl_rb_document_get(rb_node_or_doc);
+  if (!NIL_P(rb_doc)) {
+    nl_rb_document_data_unwrap(rb_doc)->mutations++;
+  }
+}
+
+static nl_document_t *
+nl_document_node_cache_owner(VALUE rb_doc)
+{
+  if (!rb_typeddata_is_kind_of(rb_doc, &nl_document_type)) {
+    return NULL;
+  }
+  return nl_rb_document_data_unwrap(rb_doc);
+}
+
+/**
+ * Get the wrapper already handed out for +node+, so that a node is
+ * represented by the same Ruby object every time it is accessed.
+ *
+ * @return The wrapper, or Qnil if +node+ hasn't been wrapped yet.
+ */
+VALUE
+nl_document_node_cache_get(VALUE rb_doc, lxb_dom_node_t *node)
+{
+  nl_document_t *doc = nl_document_node_cache_owner(rb_doc);
+  st_data_t value;
+  if (doc != NULL && doc->node_cache != NULL && st_lookup(doc->node_cache, (st_data_t)node, &value)) {
+    return (VALUE)value;
+  }
+  return Qnil;
+}
+
+/**
+ * Remember +rb_node+ as the wrapper of +node+. The wrapper is kept alive
+ * as long as the document is.
+ */
+void
+nl_document_node_cache_set(VALUE rb_doc, lxb_dom_node_t *node, VALUE rb_node)
+{
+  nl_document_t *doc = nl_document_node_cache_owner(rb_doc);
+  if (doc == NULL) {
+    return;
+  }
+  if (doc->node_cache == NULL) {
+    doc->node_cache = st_init_numtable();
+  }
+  st_insert(doc->node_cache, (st_data_t)node, (st_data_t)rb_node);
+}
+
+/**
+ * Forget the wrapper of +node+ and make it invalid, which must be called
+ * before +node+ is freed.
+ */
+void
+nl_document_node_cache_delete(VALUE rb_doc, lxb_dom_node_t *node)
+{
+  nl_document_t *doc = nl_document_node_cache_owner(rb_doc);
+  if (doc != NULL && doc->node_cache != NULL) {
+    st_data_t key = (st_data_t)node;
+    st_data_t value;
+    if (st_delete(doc->node_cache, &key, &value)) {
+      ((nl_node_t *)RTYPEDDATA_DATA((VALUE)value))->node = NULL;
+    }
+  }
+}
+
+/**
+ * Look up the memoized result of +selector+ searched from +node+.
+ *
+ * @return The cached array owned by the cache, or NULL if not found or the css
+ *         cache is disabled.
+ */
+lexbor_array_t *
+nl_document_css_cache_get(nl_document_t *doc, lxb_dom_node_t *node, VALUE selector, bool first)
+{
+  if (doc == NULL || doc->css_cache == NULL) {
+    return NULL;
+  }
+  if (doc->css_cache_mutations != doc->mutations) {
+    nl_document_css_cache_clear(doc);
+    return NULL;
+  }
+
+  VALUE rb_selector_s = rb_String(selector);
+  nl_css_cache_key_t probe = {node, first, RSTRING_LEN(rb_selector_s), (const lxb_char_t *)RSTRING_PTR(rb_selector_s)};
+
+  st_data_t value;
+  bool found = st_lookup(doc->css_cache, (st_data_t)&probe, &value);
+  RB_GC_GUARD(rb_selector_s);
+  return found ? (lexbor_array_t *)value : NULL;
+}
+
+/**
+ * Memoize a copy of +array+ as the result of +selector+ searched from +node+.
+ */
+void
+nl_document_css_cache_set(nl_document_t *doc, lxb_dom_node_t *node, VALUE selector, bool first, lexbor_array_t *array)
+{
+  if (doc == NULL || doc->css_cache == NULL) {
+    return;
+  }
+  if (doc->css_cache_mutations != doc->mutations) {
+    nl_document_css_cache_clear(doc);
+  }
+
+  lexbor_array_t *copy = lexbor_array_create();
+  if (array->length > 0) {
+    lxb_status_t status = lexbor_array_init(copy, array->length);
+    if (status != LXB_STATUS_OK) {
+      lexbor_array_destroy(copy, true);
+      return;
+    }
+    memcpy(copy->list, array->list, sizeof(lxb_dom_node_t *) * array->length);
+    copy->length = array->length;
+  }
+
+  VALUE rb_selector_s = rb_String(selector);
+  size_t selector_len = RSTRING_LEN(rb_selector_s);
+  nl_css_cache_key_t *key = ruby_xmalloc(sizeof(nl_css_cache_key_t) + selector_len);
+  key->node = node;
+  key->first = first;
+  key->selector_len = selector_len;
+  key->selector = (const lxb_char_t *)(key + 1);
+  memcpy(key + 1, RSTRING_PTR(rb_selector_s), selector_len);
+
+  st_data_t old_key = (st_data_t)key;
+  st_data_t old_value;
+  if (st_delete(doc->css_cache, &old_key, &old_value)) {
+    ruby_xfree((void *)old_key);
+    lexbor_array_destroy((lexbor_array_t *)old_value, true);
+  }
+  st_insert(doc->css_cache, (st_data_t)key, (st_data_t)copy);
+}
+
+/**
+ * call-seq:
+ *   css_cache=(enabled) -> Boolean
+ *
+ * Enable or disable memoization of {Node#css} and {Node#at_css} results
+ * for this document.
+ *
+ * When enabled, repeating the same query from the same node returns the
+ * memoized nodes instead of searching the tree again. The cache is
+ * dropped as soon as the document is changed through the Nokolexbor API,
+ * e.g. by {Node#add_child}, {Node#remove} or {Node#[]=}.
+ *
+ * @return [Boolean] +enabled+
+ */
+static VALUE
+nl_document_set_css_cache(VALUE self, VALUE rb_enabled)
+{
+  nl_document_t *doc = nl_rb_document_data_unwrap(self);
+  if (RTEST(rb_enabled)) {
+    if (doc->css_cache == NULL) {
+      doc->css_cache = st_init_table(&nl_css_cache_hash_type);
+      doc->css_cache_mutations = doc->mutations;
+    }
+  } else if (doc->css_cache != NULL) {
+    nl_document_css_cache_clear(doc);
+    st_free_table(doc->css_cache);
+    doc->css_cache = NULL;
+  }
+  return rb_enabled;
+}
+
+/**
+ * @return [Boolean] true if css results of this document are memoized.
+ *
+ * @see #css_cache=
+ */
+static VALUE
+nl_document_css_cache_p(VALUE self)
+{
+  return nl_rb_document_data_unwrap(self)->css_cache != NULL ? Qtrue : Qfalse;
+}
+
 /**
  * Get the title of this document.
  *
@@ -116,6 +1664,7 @@ nl_document_set_title(VALUE self, VALUE rb_title)
   const char *c_title = StringValuePtr(rb_title);
   size_t len = RSTRING_LEN(rb_title);
   lxb_html_document_title_set((lxb_html_document_t *)nl_rb_document_unwrap(self), (const lxb_char_t *)c_title, len);
+  nl_document_mutated(self);
   return rb_title;
 }
 
@@ -148,8 +1697,24 @@ void Init_nl_document(void)
 
   cNokolexborDocument = rb_define_class_under(mNokolexbor, "Document", cNokolexborNode);
   rb_define_singleton_method(cNokolexborDocument, "new", nl_document_new, 0);
-  rb_define_singleton_method(cNokolexborDocument, "parse_native", nl_document_parse_native, 1);
+  rb_define_const(cNokolexborDocument, "SKIP_COMMENTS", INT2FIX(NL_PARSE_SKIP_COMMENTS));
+  rb_define_const(cNokolexborDocument, "SKIP_BLANK_TEXT", INT2FIX(NL_PARSE_SKIP_BLANK_TEXT));
+  rb_define_const(cNokolexborDocument, "SKIP_SCRIPT_CONTENT", INT2FIX(NL_PARSE_SKIP_SCRIPT_CONTENT));
+  rb_define_singleton_method(cNokolexborDocument, "parse_native", nl_document_parse_native, -1);
+  rb_define_singleton_method(cNokolexborDocument, "detect_encoding", nl_document_detect_encoding, -1);
+  rb_define_singleton_method(cNokolexborDocument, "parse_file", nl_document_parse_file, 1);
+  rb_define_singleton_method(cNokolexborDocument, "parse_many_native", nl_document_parse_many_native, 2);
+  rb_define_singleton_method(cNokolexborDocument, "parse_chunk_begin", nl_document_parse_chunk_begin, -1);
+  rb_define_method(cNokolexborDocument, "parse_chunk", nl_document_parse_chunk, 1);
+  rb_define_method(cNokolexborDocument, "parse_chunk_end", nl_document_parse_chunk_end, 0);
+  rb_define_method(cNokolexborDocument, "parsing?", nl_document_parsing_p, 0);
+  rb_define_method(cNokolexborDocument, "open_elements", nl_document_open_elements, 0);
+  rb_define_method(cNokolexborDocument, "reparse_native", nl_document_reparse_native, -1);
+  rb_define_method(cNokolexborDocument, "release!", nl_document_release, 0);
+  rb_define_method(cNokolexborDocument, "released?", nl_document_released_p, 0);
   rb_define_method(cNokolexborDocument, "title", nl_document_get_title, 0);
   rb_define_method(cNokolexborDocument, "title=", nl_document_set_title, 1);
   rb_define_method(cNokolexborDocument, "root", nl_document_root, 0);
+  rb_define_method(cNokolexborDocument, "css_cache=", nl_document_set_css_cache, 1);
+  rb_define_method(cNokolexborDocument, "css_cache?", nl_document_css_cache_p, 0);
 }
@@ -8,11 +8,6 @@ pthread_key_t p_key_css_parser;
 pthread_key_t p_key_selectors;
 #endif
 
-#define SORT_NAME nl_css_result
-#define SORT_TYPE lxb_dom_node_t *
-#define SORT_CMP(x, y) (x->user >= y->user ? (x->user == y->user ? 0 : 1) : -1)
-#include "timsort.h"
-
 extern VALUE mNokolexbor;
 extern VALUE cNokolexborDocument;
 extern VALUE cNokolexborText;
@@ -22,12 +17,36 @@ extern VALUE cNokolexborProcessingInstruction;
 extern VALUE cNokolexborNodeSet;
 extern VALUE cNokolexborDocumentFragment;
 extern VALUE cNokolexborAttribute;
+extern VALUE cNokolexborSelector;
 extern VALUE eLexborError;
 VALUE cNokolexborNode;
 VALUE cNokolexborElement;
 VALUE cNokolexborCharacterData;
 
-extern rb_data_type_t nl_document_type;
+static void
+mark_nl_node(nl_node_t *data)
+{
+  rb_gc_mark_movable(data->rb_document);
+}
+
+static void
+compact_nl_node(nl_node_t *data)
+{
+  data->rb_document = rb_gc_location(data->rb_document);
+}
+
+const rb_data_type_t nl_node_type = {
+    "Nokolexbor::Node",
+    {
+        (RUBY_DATA_FUNC)mark_nl_node,
+        RUBY_TYPED_DEFAULT_FREE,
+        0,
+        (RUBY_DATA_FUNC)compact_nl_node,
+    },
+    0,
+    0,
+    RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED,
+};
 
 VALUE
 nl_rb_node_create(lxb_dom_node_t *node, VALUE rb_document)
@@ -76,21 +95,41 @@ nl_rb_node_create(lxb_dom_node_t *node, VALUE rb_document)
     rb_class = cNokolexborNode;
   }
 
-  VALUE ret = Data_Wrap_Struct(rb_class, NULL, NULL, node);
-  rb_iv_set(ret, "@document", rb_document);
+  VALUE ret = nl_document_node_cache_get(rb_document, node);
+  // The address of a destroyed node can be reused by a node of another type
+  if (!NIL_P(ret) && rb_obj_class(ret) == rb_class) {
+    return ret;
+  }
+
+  nl_node_t *data;
+  ret = TypedData_Make_Struct(rb_class, nl_node_t, &nl_node_type, data);
+  data->node = node;
+  RB_OBJ_WRITE(ret, &data->rb_document, rb_document);
+  nl_document_node_cache_set(rb_document, node, ret);
   return ret;
 }
 
 inline lxb_dom_node_t *
 nl_rb_node_unwrap(VALUE rb_node)
 {
-  lxb_dom_node_t *node;
-  if (rb_obj_is_kind_of(rb_node, cNokolexborDocument)) {
-    TypedData_Get_Struct(rb_node, lxb_dom_node_t, &nl_document_type, node);
-  } else {
-    Data_Get_Struct(rb_node, lxb_dom_node_t, node);
+  if (rb_typeddata_is_kind_of(rb_node, &nl_document_type)) {
+    return &nl_rb_document_unwrap(rb_node)->node;
   }
-  return node;
+  nl_node_t *data;
+  TypedData_Get_Struct(rb_node, nl_node_t, &nl_node_type, data);
+  if (data->node == NULL) {
+    rb_raise(rb_eRuntimeError, "Node has been freed, its document was reparsed or released");
+  }
+  return data->node;
+}
+
+/**
+ * @return [Document] The associated {Document} of this node
+ */
+static VALUE
+nl_node_document(VALUE self)
+{
+  return nl_rb_document_get(self);
 }
 
 /**
@@ -249,12 +288,14 @@ nl_node_content_set(VALUE self, VALUE content)
       lxb_dom_node_remove(node->first_child);
     }
     lxb_dom_node_insert_child(node, lxb_dom_interface_node(text));
+    nl_node_order_inserted(lxb_dom_interface_node(text));
   } else {
     lxb_status_t status = lxb_dom_node_text_content_set(node, (const lxb_char_t *)c_content, content_len);
     if (status != LXB_STATUS_OK) {
       nl_raise_lexbor_error(status);
     }
   }
+  nl_document_mutated(self);
   return content;
 }
 
@@ -322,6 +363,7 @@ nl_node_set_attr(VALUE self, VALUE rb_attr, VALUE rb_value)
   lxb_dom_element_t *element = lxb_dom_interface_element(node);
 
   lxb_dom_element_set_attribute(element, (const lxb_char_t *)attr_c, attr_len, (const lxb_char_t *)value_c, value_len);
+  nl_document_mutated(self);
 
   return rb_value;
 }
@@ -351,10 +393,16 @@ nl_node_remove_attr(VALUE self, VALUE rb_attr)
 
   lxb_dom_element_t *element = lxb_dom_interface_element(node);
 
+  lxb_dom_attr_t *attr = lxb_dom_element_attr_by_name(element, (const lxb_char_t *)attr_c, attr_len);
+  if (attr != NULL) {
+    nl_document_node_cache_delete(nl_rb_document_get(self), lxb_dom_interface_node(attr));
+  }
+
   lxb_status_t status = lxb_dom_element_remove_attribute(element, (const lxb_char_t *)attr_c, attr_len);
   if (status != LXB_STATUS_OK) {
     nl_raise_lexbor_error(status);
   }
+  nl_document_mutated(self);
 
   return Qtrue;
 }
@@ -363,181 +411,397 @@ lxb_status_t
 nl_node_at_css_callback(lxb_dom_node_t *node, lxb_css_selector_specificity_t *spec, void *ctx)
 {
   lexbor_array_t *array = (lexbor_array_t *)ctx;
-  lxb_status_t status = lexbor_array_push_unique(array, node);
-  if (status != LXB_STATUS_OK && status != LXB_STATUS_STOPPED) {
+  lxb_status_t status = lexbor_array_push(array, node);
+  if (status != LXB_STATUS_OK) {
     nl_raise_lexbor_error(status);
   }
   // Stop at first result
   return LXB_STATUS_STOP;
 }
 
+// For selectors that find each node once, see nl_selector_list_finds_unique
+static lxb_status_t
+nl_node_css_push_callback(lxb_dom_node_t *node, lxb_css_selector_specificity_t *spec, void *ctx)
+{
+  lxb_status_t status = lexbor_array_push((lexbor_array_t *)ctx, node);
+  if (status != LXB_STATUS_OK) {
+    nl_raise_lexbor_error(status);
+  }
+  return LXB_STATUS_OK;
+}
+
 lxb_status_t
 nl_node_css_callback(lxb_dom_node_t *node, lxb_css_selector_specificity_t *spec, void *ctx)
 {
-  lexbor_array_t *array = (lexbor_array_t *)ctx;
-  lxb_status_t status = lexbor_array_push_unique(array, node);
+  nl_node_set_t *set = (nl_node_set_t *)ctx;
+  lxb_status_t status = nl_node_set_push_unique(set, node);
   if (status != LXB_STATUS_OK && status != LXB_STATUS_STOPPED) {
     nl_raise_lexbor_error(status);
   }
   return LXB_STATUS_OK;
 }
 
-lxb_status_t
-nl_node_find(VALUE self, VALUE selector, lxb_selectors_cb_f cb, void *ctx)
+static lxb_css_parser_t *
+nl_css_parser_get(lxb_status_t *status)
 {
-  const char *selector_c = StringValuePtr(selector);
-  size_t selector_len = RSTRING_LEN(selector);
-
-  lxb_dom_node_t *node = nl_rb_node_unwrap(self);
-
-  lxb_status_t status;
 #ifdef HAVE_PTHREAD_H
   lxb_css_parser_t *css_parser = (lxb_css_parser_t *)pthread_getspecific(p_key_css_parser);
-  lxb_selectors_t *selectors = (lxb_selectors_t *)pthread_getspecific(p_key_selectors);
 #else
   lxb_css_parser_t *css_parser = NULL;
-  lxb_selectors_t *selectors = NULL;
 #endif
-  lxb_css_selector_list_t *list = NULL;
 
-  /* CSS parser. */
+  *status = LXB_STATUS_OK;
   if (css_parser == NULL) {
     css_parser = lxb_css_parser_create();
-    status = lxb_css_parser_init(css_parser, NULL, NULL);
-    if (status != LXB_STATUS_OK) {
-      goto init_error;
+    *status = lxb_css_parser_init(css_parser, NULL, NULL);
+    if (*status != LXB_STATUS_OK) {
+      lxb_css_parser_destroy(css_parser, true);
+      return NULL;
     }
 #ifdef HAVE_PTHREAD_H
     pthread_setspecific(p_key_css_parser, css_parser);
 #endif
   }
+  return css_parser;
+}
+
+static lxb_selectors_t *
+nl_selectors_get(lxb_status_t *status)
+{
+#ifdef HAVE_PTHREAD_H
+  lxb_selectors_t *selectors = (lxb_selectors_t *)pthread_getspecific(p_key_selectors);
+#else
+  lxb_selectors_t *selectors = NULL;
+#endif
 
-  /* Selectors. */
+  *status = LXB_STATUS_OK;
   if (selectors == NULL) {
     selectors = lxb_selectors_create();
-    status = lxb_selectors_init(selectors);
-    if (status != LXB_STATUS_OK) {
-      goto init_error;
+    *status = lxb_selectors_init(selectors);
+    if (*status != LXB_STATUS_OK) {
+      lxb_selectors_destroy(selectors, true);
+      return NULL;
     }
 #ifdef HAVE_PTHREAD_H
     pthread_setspecific(p_key_selectors, selectors);
 #endif
   }
+  return selectors;
+}
 
-  /* Parse and get the log. */
-  list = lxb_css_selectors_parse_relative_list(css_parser, (const lxb_char_t *)selector_c, selector_len);
-  if (css_parser->status != LXB_STATUS_OK) {
-    status = css_parser->status;
-    goto cleanup;
+/**
+ * Parse +selector+ into a selector list which owns its memory.
+ *
+ * Returns NULL and sets +status+ on syntax or allocation errors, the
+ * returned list must be freed with lxb_css_selector_list_destroy_memory.
+ */
+lxb_css_selector_list_t *
+nl_css_selectors_parse(const lxb_char_t *selector, size_t selector_len, lxb_status_t *status)
+{
+  lxb_css_parser_t *css_parser = nl_css_parser_get(status);
+  if (css_parser == NULL) {
+    return NULL;
   }
 
-  /* Find HTML nodes by CSS Selectors. */
-  status = lxb_selectors_find(selectors, node, list, cb, ctx);
+  lxb_css_selector_list_t *list = lxb_css_selectors_parse_relative_list(css_parser, selector, selector_len);
+  *status = css_parser->status;
+  if (*status != LXB_STATUS_OK) {
+    lxb_css_selector_list_destroy_memory(list);
+    list = NULL;
+  }
 
-cleanup:
 #ifndef HAVE_PTHREAD_H
-  /* Destroy Selectors object. */
-  (void)lxb_selectors_destroy(selectors, true);
-
   /* Destroy resources for CSS Parser. */
   (void)lxb_css_parser_destroy(css_parser, true);
 #endif
 
-  /* Destroy all object for all CSS Selector List. */
-  lxb_css_selector_list_destroy_memory(list);
-
-  return status;
+  return list;
+}
 
-init_error:
-  /* Destroy Selectors object. */
-  lxb_selectors_destroy(selectors, true);
-  selectors = NULL;
+/**
+ * Get the selector list of +selector+, a String or a {Selector}. Strings are
+ * parsed into a list that must be destroyed by the caller, which is told by
+ * +owns_list+.
+ */
+static lxb_css_selector_list_t *
+nl_selector_list_get(VALUE selector, bool *owns_list, lxb_status_t *status)
+{
+  /* Compiled selectors are reused as is, strings are parsed for this query only. */
+  *owns_list = !rb_obj_is_kind_of(selector, cNokolexborSelector);
+  if (*owns_list) {
+    const char *selector_c = StringValuePtr(selector);
+    size_t selector_len = RSTRING_LEN(selector);
+    return nl_css_selectors_parse((const lxb_char_t *)selector_c, selector_len, status);
+  }
+  *status = LXB_STATUS_OK;
+  return nl_rb_selector_unwrap(selector);
+}
 
-  /* Destroy resources for CSS Parser. */
-  lxb_css_parser_destroy(css_parser, true);
-  css_parser = NULL;
+/**
+ * Whether every selector of +list+ can be matched from right to left at
+ * each node, so that the whole list is evaluated in a single traversal.
+ * Selectors starting with a sibling combinator and :has(), which the
+ * selectors engine only evaluates forwards, are left to lxb_selectors_find.
+ */
+static bool
+nl_selector_list_matches_in_one_pass(lxb_css_selector_list_t *list)
+{
+  for (; list != NULL; list = list->next) {
+    if (list->first == NULL || (list->first->combinator != LXB_CSS_SELECTOR_COMBINATOR_DESCENDANT &&
+                                list->first->combinator != LXB_CSS_SELECTOR_COMBINATOR_CHILD)) {
+      return false;
+    }
+    for (lxb_css_selector_t *selector = list->first; selector != NULL; selector = selector->next) {
+      switch (selector->combinator) {
+      case LXB_CSS_SELECTOR_COMBINATOR_DESCENDANT:
+      case LXB_CSS_SELECTOR_COMBINATOR_CLOSE:
+      case LXB_CSS_SELECTOR_COMBINATOR_CHILD:
+      case LXB_CSS_SELECTOR_COMBINATOR_SIBLING:
+      case LXB_CSS_SELECTOR_COMBINATOR_FOLLOWING:
+        break;
+      default:
+        return false;
+      }
+      if (selector->type == LXB_CSS_SELECTOR_TYPE_PSEUDO_CLASS_FUNCTION &&
+          selector->u.pseudo.type == LXB_CSS_SELECTOR_PSEUDO_CLASS_FUNCTION_HAS) {
+        return false;
+      }
+      // Pseudo elements such as ::text are only matched in the last compound
+      if (selector->type == LXB_CSS_SELECTOR_TYPE_PSEUDO_ELEMENT) {
+        for (lxb_css_selector_t *next = selector->next; next != NULL; next = next->next) {
+          if (next->combinator != LXB_CSS_SELECTOR_COMBINATOR_CLOSE) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
 
-#ifdef HAVE_PTHREAD_H
-  pthread_setspecific(p_key_css_parser, NULL);
-  pthread_setspecific(p_key_selectors, NULL);
-#endif
+/**
+ * Whether the nodes matching +list+ are found in document order.
+ */
+static bool
+nl_selector_list_finds_in_order(lxb_css_selector_list_t *list)
+{
+  return list->next == NULL || nl_selector_list_matches_in_one_pass(list);
+}
 
-  return status;
+/**
+ * A node is found at most once by a single compound selector such as
+ * "div.a[href]", or by a list evaluated in one pass. Other lists and
+ * combinators can reach a node several times, e.g. "div span" through each
+ * of its div ancestors.
+ */
+static bool
+nl_selector_list_finds_unique(lxb_css_selector_list_t *list)
+{
+  if (list->next != NULL) {
+    return nl_selector_list_matches_in_one_pass(list);
+  }
+  for (lxb_css_selector_t *selector = list->first; selector != NULL; selector = selector->next) {
+    if (selector != list->first && selector->combinator != LXB_CSS_SELECTOR_COMBINATOR_CLOSE) {
+      return false;
+    }
+  }
+  return true;
 }
 
-static void
-mark_node_orders(lxb_dom_node_t *root)
-{
-  size_t count = 1;
-  root->user = (void *)count;
-  lxb_dom_node_t *node = root;
-  do {
-    if (node->first_child != NULL) {
-      node = node->first_child;
-      node->user = (void *)++count;
-    } else {
-      while (node != root && node->next == NULL) {
-        node = node->parent;
+/**
+ * @return The first selector of +list+ matching +node+, a descendant of
+ *         +root+, or NULL. Like lxb_selectors_find, text nodes are only
+ *         matched by compound selectors starting with a pseudo element such
+ *         as ::text.
+ */
+static lxb_css_selector_list_t *
+nl_selector_list_match_node(lxb_selectors_t *selectors, lxb_dom_node_t *root, lxb_css_selector_list_t *list, lxb_dom_node_t *node)
+{
+  if (node->type != LXB_DOM_NODE_TYPE_ELEMENT && node->type != LXB_DOM_NODE_TYPE_TEXT) {
+    return NULL;
+  }
+  for (lxb_css_selector_list_t *item = list; item != NULL; item = item->next) {
+    if (node->type == LXB_DOM_NODE_TYPE_TEXT) {
+      lxb_css_selector_t *compound = item->last;
+      while (compound->combinator == LXB_CSS_SELECTOR_COMBINATOR_CLOSE && compound->prev != NULL) {
+        compound = compound->prev;
       }
-
-      if (node == root) {
-        break;
+      if (compound->type != LXB_CSS_SELECTOR_TYPE_PSEUDO_ELEMENT) {
+        continue;
       }
-
-      node = node->next;
-      node->user = (void *)++count;
     }
+    if (lxb_selectors_match_chain_rtl(selectors, item->last, node, root)) {
+      return item;
+    }
+  }
+  return NULL;
+}
 
-  } while (true);
+/**
+ * @return The descendant of +root+ following +node+ in document order, or
+ *         NULL.
+ */
+static lxb_dom_node_t *
+nl_node_next_descendant(lxb_dom_node_t *root, lxb_dom_node_t *node)
+{
+  if (node->first_child != NULL) {
+    return node->first_child;
+  }
+  while (node != root && node->next == NULL) {
+    node = node->parent;
+  }
+  return node == root ? NULL : node->next;
 }
 
-// Sort nodes in document traversal order (the same as Nokorigi)
-void nl_sort_nodes_if_necessary(VALUE selector, lxb_dom_document_t *doc, lexbor_array_t *array)
+/**
+ * Find the nodes matching any selector of +list+ in a single traversal of
+ * the descendants of +root+, so that each node is found once and in
+ * document order.
+ */
+static lxb_status_t
+nl_node_find_list_in_one_pass(lxb_selectors_t *selectors, lxb_dom_node_t *root, lxb_css_selector_list_t *list,
+                              lxb_selectors_cb_f cb, void *ctx)
 {
-  // No need to sort if there's only one selector, the results are natually in document traversal order
-  if (strchr(RSTRING_PTR(selector), ',') != NULL) {
-    int need_order = 0;
-    // Check if we have already markded orders, note that
-    // we need to order again if new nodes are added to the document
-    for (size_t i = 0; i < array->length; i++) {
-      if (((lxb_dom_node_t *)array->list[i])->user == 0) {
-        need_order = 1;
-        break;
+  for (lxb_dom_node_t *node = root->first_child; node != NULL; node = nl_node_next_descendant(root, node)) {
+    lxb_css_selector_list_t *item = nl_selector_list_match_node(selectors, root, list, node);
+    if (item != NULL) {
+      lxb_status_t status = cb(node, &item->specificity, ctx);
+      if (status == LXB_STATUS_STOP) {
+        return LXB_STATUS_OK;
+      }
+      if (status != LXB_STATUS_OK) {
+        return status;
       }
     }
-    if (need_order) {
-      mark_node_orders(&doc->node);
+  }
+  return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+nl_node_find_list(lxb_dom_node_t *node, lxb_css_selector_list_t *list, lxb_selectors_cb_f cb, void *ctx)
+{
+  lxb_status_t status;
+  lxb_selectors_t *selectors = nl_selectors_get(&status);
+  if (selectors != NULL) {
+    if (list->next != NULL && nl_selector_list_matches_in_one_pass(list)) {
+      status = nl_node_find_list_in_one_pass(selectors, node, list, cb, ctx);
+    } else {
+      /* Find HTML nodes by CSS Selectors. */
+      status = lxb_selectors_find(selectors, node, list, cb, ctx);
     }
-    nl_css_result_tim_sort((lxb_dom_node_t **)&array->list[0], array->length);
+
+#ifndef HAVE_PTHREAD_H
+    /* Destroy Selectors object. */
+    (void)lxb_selectors_destroy(selectors, true);
+#endif
   }
+  return status;
 }
 
 /**
- * Internal implementation of {#at_css}
+ * Find the nodes under +self+ matching +selector+, a String or a {Selector}.
+ * +in_order+, unless NULL, is set to whether they are found in document
+ * order, otherwise they must be sorted with nl_node_order_sort.
+ */
+lxb_status_t
+nl_node_find(VALUE self, VALUE selector, lxb_selectors_cb_f cb, void *ctx, bool *in_order)
+{
+  lxb_dom_node_t *node = nl_rb_node_unwrap(self);
+  bool owns_list;
+  lxb_status_t status;
+
+  lxb_css_selector_list_t *list = nl_selector_list_get(selector, &owns_list, &status);
+  if (list == NULL) {
+    return status;
+  }
+
+  if (in_order != NULL) {
+    *in_order = nl_selector_list_finds_in_order(list);
+  }
+  status = nl_node_find_list(node, list, cb, ctx);
+
+  if (owns_list) {
+    /* Destroy all object for all CSS Selector List. */
+    lxb_css_selector_list_destroy_memory(list);
+  }
+
+  return status;
+}
+
+/**
+ * Find the nodes matching +selector+ under +self+, in document order, from
+ * the css cache of the document if enabled. If +first+, only the first match
+ * is searched for.
  *
- * @see #at_css
+ * @return A new array owned by the caller.
  */
-static VALUE
-nl_node_at_css(VALUE self, VALUE selector)
+static lexbor_array_t *
+nl_node_css_nodes(VALUE self, VALUE selector, bool first)
 {
   lxb_dom_node_t *node = nl_rb_node_unwrap(self);
+  VALUE rb_doc = nl_rb_document_get(self);
+  nl_document_t *doc = NIL_P(rb_doc) ? NULL : nl_rb_document_data_unwrap(rb_doc);
   lexbor_array_t *array = lexbor_array_create();
 
-  lxb_status_t status = nl_node_find(self, selector, nl_node_at_css_callback, array);
+  lexbor_array_t *cached = nl_document_css_cache_get(doc, node, selector, first);
+  if (cached != NULL) {
+    if (cached->length > 0) {
+      lxb_status_t status = lexbor_array_init(array, cached->length);
+      if (status != LXB_STATUS_OK) {
+        lexbor_array_destroy(array, true);
+        nl_raise_lexbor_error(status);
+      }
+      memcpy(array->list, cached->list, sizeof(lxb_dom_node_t *) * cached->length);
+      array->length = cached->length;
+    }
+    return array;
+  }
 
-  if (status != LXB_STATUS_OK) {
+  bool owns_list;
+  lxb_status_t status;
+  lxb_css_selector_list_t *list = nl_selector_list_get(selector, &owns_list, &status);
+  if (list == NULL) {
     lexbor_array_destroy(array, true);
     nl_raise_lexbor_error(status);
   }
 
-  if (array->length == 0) {
+  bool in_order = nl_selector_list_finds_in_order(list);
+  if (first) {
+    status = nl_node_find_list(node, list, nl_node_at_css_callback, array);
+  } else if (nl_selector_list_finds_unique(list)) {
+    status = nl_node_find_list(node, list, nl_node_css_push_callback, array);
+  } else {
+    nl_node_set_t set = {array, NULL};
+    status = nl_node_find_list(node, list, nl_node_css_callback, &set);
+    nl_node_set_index_destroy(&set);
+  }
+  if (owns_list) {
+    lxb_css_selector_list_destroy_memory(list);
+  }
+  if (status != LXB_STATUS_OK) {
     lexbor_array_destroy(array, true);
-    return Qnil;
+    nl_raise_lexbor_error(status);
+  }
+
+  if (!in_order) {
+    nl_node_order_sort((lxb_dom_node_t **)array->list, array->length);
   }
+  nl_document_css_cache_set(doc, node, selector, first, array);
+
+  return array;
+}
 
-  nl_sort_nodes_if_necessary(selector, node->owner_document, array);
+/**
+ * Internal implementation of {#at_css}
+ *
+ * @see #at_css
+ */
+static VALUE
+nl_node_at_css(VALUE self, VALUE selector)
+{
+  lexbor_array_t *array = nl_node_css_nodes(self, selector, true);
 
-  VALUE ret = nl_rb_node_create(array->list[0], nl_rb_document_get(self));
+  VALUE ret = array->length > 0 ? nl_rb_node_create(array->list[0], nl_rb_document_get(self)) : Qnil;
 
   lexbor_array_destroy(array, true);
 
@@ -551,19 +815,294 @@ nl_node_at_css(VALUE self, VALUE selector)
  */
 static VALUE
 nl_node_css(VALUE self, VALUE selector)
+{
+  lexbor_array_t *array = nl_node_css_nodes(self, selector, false);
+  return nl_rb_node_set_create_with_data(array, nl_rb_document_get(self));
+}
+
+static VALUE
+nl_node_extract_value(lxb_dom_node_t *node, VALUE rb_attr)
+{
+  if (NIL_P(rb_attr)) {
+    size_t str_len = 0;
+    lxb_char_t *text = lxb_dom_node_text_content(node, &str_len);
+    if (text == NULL) {
+      return rb_str_new("", 0);
+    }
+    VALUE rb_str = rb_utf8_str_new((char *)text, str_len);
+    lxb_dom_document_destroy_text(node->owner_document, text);
+    return rb_str;
+  }
+
+  if (node->type != LXB_DOM_NODE_TYPE_ELEMENT) {
+    return Qnil;
+  }
+  lxb_dom_element_t *element = lxb_dom_interface_element(node);
+  const lxb_char_t *attr = (const lxb_char_t *)RSTRING_PTR(rb_attr);
+  size_t attr_len = RSTRING_LEN(rb_attr);
+  if (!lxb_dom_element_has_attribute(element, attr, attr_len)) {
+    return Qnil;
+  }
+  size_t value_len;
+  const lxb_char_t *value = lxb_dom_element_get_attribute(element, attr, attr_len, &value_len);
+  return rb_utf8_str_new((const char *)value, value_len);
+}
+
+typedef struct {
+  size_t count;
+  /* Nodes counted so far, NULL if the selector can't match a node twice */
+  st_table *seen;
+} nl_css_count_t;
+
+static lxb_status_t
+nl_node_css_count_callback(lxb_dom_node_t *node, lxb_css_selector_specificity_t *spec, void *ctx)
+{
+  nl_css_count_t *counter = (nl_css_count_t *)ctx;
+  if (counter->seen == NULL || !st_insert(counter->seen, (st_data_t)node, 0)) {
+    counter->count++;
+  }
+  return LXB_STATUS_OK;
+}
+
+/**
+ * Internal implementation of {#css_count}
+ *
+ * @see #css_count
+ */
+static VALUE
+nl_node_css_count(VALUE self, VALUE selector)
 {
   lxb_dom_node_t *node = nl_rb_node_unwrap(self);
-  lexbor_array_t *array = lexbor_array_create();
+  bool owns_list;
+  lxb_status_t status;
+
+  lxb_css_selector_list_t *list = nl_selector_list_get(selector, &owns_list, &status);
+  if (list == NULL) {
+    nl_raise_lexbor_error(status);
+  }
 
-  lxb_status_t status = nl_node_find(self, selector, nl_node_css_callback, array);
+  nl_css_count_t counter = {0, NULL};
+  if (!nl_selector_list_finds_unique(list)) {
+    counter.seen = st_init_numtable();
+  }
+  status = nl_node_find_list(node, list, nl_node_css_count_callback, &counter);
+
+  if (counter.seen != NULL) {
+    st_free_table(counter.seen);
+  }
+  if (owns_list) {
+    lxb_css_selector_list_destroy_memory(list);
+  }
   if (status != LXB_STATUS_OK) {
-    lexbor_array_destroy(array, true);
     nl_raise_lexbor_error(status);
   }
+  return SIZET2NUM(counter.count);
+}
 
-  nl_sort_nodes_if_necessary(selector, node->owner_document, array);
+static lxb_status_t
+nl_node_css_any_callback(lxb_dom_node_t *node, lxb_css_selector_specificity_t *spec, void *ctx)
+{
+  *(bool *)ctx = true;
+  return LXB_STATUS_STOP;
+}
 
-  return nl_rb_node_set_create_with_data(array, nl_rb_document_get(self));
+/**
+ * Internal implementation of {#css_any?}
+ *
+ * @see #css_any?
+ */
+static VALUE
+nl_node_css_any(VALUE self, VALUE selector)
+{
+  bool found = false;
+  lxb_status_t status = nl_node_find(self, selector, nl_node_css_any_callback, &found, NULL);
+  if (status != LXB_STATUS_OK) {
+    nl_raise_lexbor_error(status);
+  }
+  return found ? Qtrue : Qfalse;
+}
+
+/**
+ * Internal implementation of {#css_text} and {#css_attr}
+ *
+ * @see #css_text
+ * @see #css_attr
+ */
+static VALUE
+nl_node_css_values(VALUE self, VALUE selector, VALUE rb_attr)
+{
+  if (!NIL_P(rb_attr)) {
+    rb_attr = rb_String(rb_attr);
+  }
+  lexbor_array_t *array = nl_node_css_nodes(self, selector, false);
+
+  VALUE rb_values = rb_ary_new_capa(array->length);
+  for (size_t i = 0; i < array->length; i++) {
+    rb_ary_push(rb_values, nl_node_extract_value(array->list[i], rb_attr));
+  }
+
+  lexbor_array_destroy(array, true);
+  return rb_values;
+}
+
+/**
+ * Internal implementation of {#at_css_text}
+ *
+ * @see #at_css_text
+ */
+static VALUE
+nl_node_at_css_text(VALUE self, VALUE selector)
+{
+  lexbor_array_t *array = nl_node_css_nodes(self, selector, true);
+
+  VALUE ret = array->length > 0 ? nl_node_extract_value(array->list[0], Qnil) : Qnil;
+
+  lexbor_array_destroy(array, true);
+  return ret;
+}
+
+typedef struct {
+  VALUE rb_key;
+  lxb_css_selector_list_t *list;
+  VALUE rb_attr;
+  bool all;
+  /* The Array of values if +all+ */
+  VALUE rb_values;
+  bool found;
+} nl_extract_field_t;
+
+/**
+ * Fill the fields of +rb_result+ whose selectors are matched at each
+ * descendant of +root+ in a single traversal, which stops once every field
+ * wanting a single value has it.
+ */
+static lxb_status_t
+nl_node_extract_in_one_pass(lxb_dom_node_t *root, nl_extract_field_t *fields, long fields_len, VALUE rb_result)
+{
+  lxb_status_t status;
+  lxb_selectors_t *selectors = nl_selectors_get(&status);
+  if (selectors == NULL) {
+    return status;
+  }
+
+  long missing = 0;
+  bool all = false;
+  for (long i = 0; i < fields_len; i++) {
+    all = all || fields[i].all;
+    missing += !fields[i].all;
+  }
+
+  for (lxb_dom_node_t *node = root->first_child; node != NULL && (all || missing > 0);
+       node = nl_node_next_descendant(root, node)) {
+    for (long i = 0; i < fields_len; i++) {
+      nl_extract_field_t *field = &fields[i];
+      if (field->found || nl_selector_list_match_node(selectors, root, field->list, node) == NULL) {
+        continue;
+      }
+      VALUE rb_value = nl_node_extract_value(node, field->rb_attr);
+      if (field->all) {
+        rb_ary_push(field->rb_values, rb_value);
+      } else {
+        rb_hash_aset(rb_result, field->rb_key, rb_value);
+        field->found = true;
+        missing--;
+      }
+    }
+  }
+
+#ifndef HAVE_PTHREAD_H
+  (void)lxb_selectors_destroy(selectors, true);
+#endif
+  return LXB_STATUS_OK;
+}
+
+/**
+ * Internal implementation of {#extract}
+ *
+ * +rb_fields+ are the fields of an {Extractor}, each one an Array of the
+ * key, the Selector or nil for this node itself, the attribute name or nil
+ * for the text, and whether all matches are wanted.
+ *
+ * The selectors of all the fields are evaluated in the same traversal of
+ * the subtree, except those that can't be matched at each node, which are
+ * searched for separately.
+ *
+ * @see #extract
+ */
+static VALUE
+nl_node_extract(VALUE self, VALUE rb_fields)
+{
+  lxb_dom_node_t *node = nl_rb_node_unwrap(self);
+  Check_Type(rb_fields, T_ARRAY);
+
+  VALUE rb_result = rb_hash_new();
+  VALUE rb_buffer;
+  nl_extract_field_t *fields = ALLOCV_N(nl_extract_field_t, rb_buffer, RARRAY_LEN(rb_fields));
+  long fields_len = 0;
+
+  for (long i = 0; i < RARRAY_LEN(rb_fields); i++) {
+    VALUE rb_field = RARRAY_AREF(rb_fields, i);
+    VALUE rb_key = RARRAY_AREF(rb_field, 0);
+    VALUE rb_selector = RARRAY_AREF(rb_field, 1);
+    VALUE rb_attr = RARRAY_AREF(rb_field, 2);
+    bool all = RTEST(RARRAY_AREF(rb_field, 3));
+
+    if (NIL_P(rb_selector)) {
+      VALUE rb_value = nl_node_extract_value(node, rb_attr);
+      rb_hash_aset(rb_result, rb_key, all ? rb_ary_new_from_args(1, rb_value) : rb_value);
+      continue;
+    }
+
+    lxb_css_selector_list_t *list = nl_rb_selector_unwrap(rb_selector);
+    if (nl_selector_list_matches_in_one_pass(list)) {
+      // Set now to keep the keys in the order of the fields
+      VALUE rb_values = all ? rb_ary_new() : Qnil;
+      rb_hash_aset(rb_result, rb_key, rb_values);
+      fields[fields_len++] = (nl_extract_field_t){rb_key, list, rb_attr, all, rb_values, false};
+      continue;
+    }
+
+    lexbor_array_t *array = lexbor_array_create();
+    lxb_status_t status;
+    bool in_order = nl_selector_list_finds_in_order(list);
+    // The first match of a list is only known once all lists are searched
+    if (all || !in_order) {
+      nl_node_set_t set = {array, NULL};
+      status = nl_node_find_list(node, list, nl_node_css_callback, &set);
+      nl_node_set_index_destroy(&set);
+    } else {
+      status = nl_node_find_list(node, list, nl_node_at_css_callback, array);
+    }
+    if (status != LXB_STATUS_OK) {
+      lexbor_array_destroy(array, true);
+      nl_raise_lexbor_error(status);
+    }
+    if (!in_order) {
+      nl_node_order_sort((lxb_dom_node_t **)array->list, array->length);
+    }
+
+    VALUE rb_value;
+    if (all) {
+      rb_value = rb_ary_new_capa(array->length);
+      for (size_t j = 0; j < array->length; j++) {
+        rb_ary_push(rb_value, nl_node_extract_value(array->list[j], rb_attr));
+      }
+    } else {
+      rb_value = array->length > 0 ? nl_node_extract_value(array->list[0], rb_attr) : Qnil;
+    }
+    lexbor_array_destroy(array, true);
+    rb_hash_aset(rb_result, rb_key, rb_value);
+  }
+
+  if (fields_len > 0) {
+    lxb_status_t status = nl_node_extract_in_one_pass(node, fields, fields_len, rb_result);
+    if (status != LXB_STATUS_OK) {
+      nl_raise_lexbor_error(status);
+    }
+  }
+  ALLOCV_END(rb_buffer);
+
+  return rb_result;
 }
 
 /**
@@ -900,6 +1439,18 @@ nl_node_child(VALUE self)
   return child ? nl_rb_node_create(child, nl_rb_document_get(self)) : Qnil;
 }
 
+/**
+ * Raise if the document of +self+ is being parsed in chunks, +action+ would
+ * break the parser's state then.
+ */
+static void
+nl_node_check_not_parsing(VALUE self, const char *action)
+{
+  if (nl_document_is_parsing(nl_rb_document_get(self))) {
+    rb_raise(rb_eRuntimeError, "Cannot %s while the document is being parsed", action);
+  }
+}
+
 /**
  * Remove this node from its current context.
  *
@@ -910,6 +1461,7 @@ nl_node_remove(VALUE self)
 {
   lxb_dom_node_t *node = nl_rb_node_unwrap(self);
   lxb_dom_node_remove(node);
+  nl_document_mutated(self);
   return self;
 }
 
@@ -924,7 +1476,15 @@ static VALUE
 nl_node_destroy(VALUE self)
 {
   lxb_dom_node_t *node = nl_rb_node_unwrap(self);
+  // The parser may still append to this node or its descendants.
+  nl_node_check_not_parsing(self, "destroy a node");
+  nl_document_node_cache_delete(nl_rb_document_get(self), node);
+  // self isn't the cached wrapper if its document isn't a Document
+  if (!rb_typeddata_is_kind_of(self, &nl_document_type)) {
+    ((nl_node_t *)RTYPEDDATA_DATA(self))->node = NULL;
+  }
   lxb_dom_node_destroy(node);
+  nl_document_mutated(self);
   return Qnil;
 }
 
@@ -934,9 +1494,12 @@ nl_node_destroy(VALUE self)
 static VALUE
 nl_node_equals(VALUE self, VALUE other)
 {
-  if (!rb_obj_is_kind_of(other, cNokolexborNode)) {
+  if (!rb_typeddata_is_kind_of(other, &nl_node_type) && !rb_typeddata_is_kind_of(other, &nl_document_type)) {
     return Qfalse;
   }
+  if (self == other) {
+    return Qtrue;
+  }
   lxb_dom_node_t *node1 = nl_rb_node_unwrap(self);
   lxb_dom_node_t *node2 = nl_rb_node_unwrap(other);
   return node1 == node2 ? Qtrue : Qfalse;
@@ -1009,6 +1572,8 @@ nl_node_parse(VALUE self, VALUE html)
   lxb_dom_node_t *node = nl_rb_node_unwrap(self);
   lxb_dom_document_t *doc = node->owner_document;
 
+  // Fragments are parsed by the parser of the document.
+  nl_node_check_not_parsing(self, "parse a fragment");
   lxb_dom_node_t *frag_root = nl_node_parse_fragment(doc, lxb_dom_interface_element(node), (lxb_char_t *)RSTRING_PTR(html), RSTRING_LEN(html));
   lexbor_array_t *array = lexbor_array_create();
 
@@ -1029,6 +1594,15 @@ nl_node_add_nodes(VALUE self, VALUE new, lxb_dom_node_add_nodes_to_f add_to, boo
   lxb_dom_node_t *node = nl_rb_node_unwrap(self);
   lxb_dom_document_t *doc = node->owner_document;
 
+  nl_document_mutated(self);
+  if (rb_obj_is_kind_of(new, cNokolexborNode)) {
+    // The added nodes are removed from their previous place, which may be in another document
+    nl_document_mutated(new);
+  }
+
+  if (TYPE(new) == T_STRING) {
+    nl_node_check_not_parsing(self, "parse a fragment");
+  }
   if (TYPE(new) == T_STRING || rb_obj_is_kind_of(new, cNokolexborDocumentFragment)) {
     lxb_dom_node_t *frag_root = (TYPE(new) == T_STRING) ? nl_node_parse_fragment(doc, NULL, (lxb_char_t *)RSTRING_PTR(new), RSTRING_LEN(new))
                                                         : nl_rb_node_unwrap(new);
@@ -1039,6 +1613,7 @@ nl_node_add_nodes(VALUE self, VALUE new, lxb_dom_node_add_nodes_to_f add_to, boo
       lxb_dom_node_t *child = frag_root->first_child;
       lxb_dom_node_remove(child);
       operate_on_new_node ? add_to(last_node, child) : add_to(node, child);
+      nl_node_order_inserted(child);
       last_node = child;
       lexbor_array_push(array, child);
     }
@@ -1055,6 +1630,7 @@ nl_node_add_nodes(VALUE self, VALUE new, lxb_dom_node_add_nodes_to_f add_to, boo
       lxb_dom_node_t *child = (lxb_dom_node_t *)node_array->list[i];
       lxb_dom_node_remove(child);
       operate_on_new_node ? add_to(last_node, child) : add_to(node, child);
+      nl_node_order_inserted(child);
       last_node = child;
     }
     return new;
@@ -1063,6 +1639,7 @@ nl_node_add_nodes(VALUE self, VALUE new, lxb_dom_node_add_nodes_to_f add_to, boo
     lxb_dom_node_t *node_new = nl_rb_node_unwrap(new);
     lxb_dom_node_remove(node_new);
     add_to(node, node_new);
+    nl_node_order_inserted(node_new);
     return new;
 
   } else {
@@ -1268,10 +1845,16 @@ void Init_nl_node(void)
   rb_define_method(cNokolexborNode, "[]", nl_node_get_attr, 1);
   rb_define_method(cNokolexborNode, "[]=", nl_node_set_attr, 2);
   rb_define_method(cNokolexborNode, "remove_attr", nl_node_remove_attr, 1);
+  rb_define_method(cNokolexborNode, "document", nl_node_document, 0);
   rb_define_method(cNokolexborNode, "==", nl_node_equals, 1);
   rb_define_method(cNokolexborNode, "pointer_id", nl_node_pointer_id, 0);
   rb_define_method(cNokolexborNode, "css_impl", nl_node_css, 1);
   rb_define_method(cNokolexborNode, "at_css_impl", nl_node_at_css, 1);
+  rb_define_method(cNokolexborNode, "css_values_impl", nl_node_css_values, 2);
+  rb_define_method(cNokolexborNode, "css_count_impl", nl_node_css_count, 1);
+  rb_define_method(cNokolexborNode, "css_any_impl", nl_node_css_any, 1);
+  rb_define_method(cNokolexborNode, "at_css_text_impl", nl_node_at_css_text, 1);
+  rb_define_method(cNokolexborNode, "extract_impl", nl_node_extract, 1);
   rb_define_method(cNokolexborNode, "inner_html", nl_node_inner_html, -1);
   rb_define_method(cNokolexborNode, "outer_html", nl_node_outer_html, -1);
   rb_define_method(cNokolexborNode, "key?", nl_node_has_key, 1);
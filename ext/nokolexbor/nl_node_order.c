@@ -0,0 +1,209 @@
+#include "nokolexbor.h"
+#include "config.h"
+#include "libxml/xpath.h"
+
+/*
+ * Document order keys, shared by the sorts of css and xpath results.
+ *
+ * The key of a node is kept in node->user, the epoch of the keys in its
+ * high bits and a position in preorder in its low bits. The key of the
+ * document node holds the current epoch with a position of 0, or has
+ * NL_ORDER_STALE set while the keys of its nodes may not reflect the order
+ * anymore. Renumbering the document starts a new epoch, which invalidates
+ * every key assigned before in O(1), including those of the nodes that have
+ * been detached since.
+ *
+ * Positions are assigned NL_ORDER_GAP apart, so that nodes inserted through
+ * the Ruby API are given keys between those of their neighbours without
+ * renumbering the rest of the document. Nodes created by lexbor have a key
+ * of 0, which is never valid.
+ */
+
+#define SORT_NAME nl_node_order
+#define SORT_TYPE lxb_dom_node_t *
+#define SORT_CMP(x, y) (nl_node_order_compare(x, y))
+#include "timsort.h"
+
+#define NL_ORDER_EPOCH_MASK (((uintptr_t)1 << NL_ORDER_EPOCH_BITS) - 1)
+
+static lxb_dom_node_t *
+nl_node_order_next(lxb_dom_node_t *root, lxb_dom_node_t *node)
+{
+  if (node->first_child != NULL) {
+    return node->first_child;
+  }
+  while (node != root && node->next == NULL) {
+    node = node->parent;
+  }
+  return node == root ? NULL : node->next;
+}
+
+static lxb_dom_node_t *
+nl_node_order_root(lxb_dom_node_t *node)
+{
+  while (node->parent != NULL) {
+    node = node->parent;
+  }
+  return node;
+}
+
+/**
+ * Assign keys to all the nodes of +doc+ in a new epoch.
+ *
+ * @return The number of nodes numbered, or -1 if they don't fit in the
+ *   positions available, the keys of +doc+ are then left stale.
+ */
+long
+nl_node_order_assign(lxb_dom_document_t *doc)
+{
+  lxb_dom_node_t *root = &doc->node;
+  uintptr_t epoch = (((uintptr_t)root->user >> NL_ORDER_POSITION_BITS) + 1) & NL_ORDER_EPOCH_MASK;
+  if (epoch == 0) {
+    epoch = 1;
+  }
+  uintptr_t tag = epoch << NL_ORDER_POSITION_BITS;
+  uintptr_t position = 0;
+  long count = 0;
+
+  root->user = (void *)(tag | NL_ORDER_STALE);
+  for (lxb_dom_node_t *node = nl_node_order_next(root, root); node != NULL; node = nl_node_order_next(root, node)) {
+    if (position > NL_ORDER_POSITION_MASK - NL_ORDER_GAP) {
+      return -1;
+    }
+    position += NL_ORDER_GAP;
+    node->user = (void *)(tag | position);
+    count++;
+  }
+  root->user = (void *)tag;
+
+  return count;
+}
+
+/**
+ * Mark the keys of +doc+ as stale, after the tree has been changed in a
+ * way that may have moved nodes, e.g. by the parser.
+ */
+void
+nl_node_order_invalidate(lxb_dom_document_t *doc)
+{
+  doc->node.user = (void *)((uintptr_t)doc->node.user | NL_ORDER_STALE);
+}
+
+/**
+ * Give keys to +node+ and its descendants after they have been inserted
+ * in the tree, between the keys of the nodes before and after them. The
+ * keys of the document are marked as stale if there is no room left.
+ */
+void
+nl_node_order_inserted(lxb_dom_node_t *node)
+{
+  lxb_dom_node_t *root = &node->owner_document->node;
+  uintptr_t tag = (uintptr_t)root->user;
+  if (tag == 0 || (tag & NL_ORDER_POSITION_MASK) != 0) {
+    return;
+  }
+
+  if (nl_node_order_root(node) != root) {
+    // Inserted in a detached tree, whose nodes are never numbered, the keys
+    // of their previous place must not be compared anymore.
+    for (lxb_dom_node_t *cur = node; cur != NULL; cur = nl_node_order_next(node, cur)) {
+      cur->user = NULL;
+    }
+    return;
+  }
+
+  lxb_dom_node_t *prev = node->prev;
+  if (prev == NULL) {
+    prev = node->parent;
+  } else {
+    while (prev->last_child != NULL) {
+      prev = prev->last_child;
+    }
+  }
+  lxb_dom_node_t *next = node;
+  while (next != NULL && next->next == NULL) {
+    next = next->parent;
+  }
+  if (next != NULL) {
+    next = next->next;
+  }
+  if ((prev != root && !nl_node_order_known(prev)) || (next != NULL && !nl_node_order_known(next))) {
+    nl_node_order_invalidate(node->owner_document);
+    return;
+  }
+
+  uintptr_t low = (uintptr_t)prev->user & NL_ORDER_POSITION_MASK;
+  uintptr_t high = next != NULL ? (uintptr_t)next->user & NL_ORDER_POSITION_MASK : NL_ORDER_POSITION_MASK;
+  size_t count = 0;
+  for (lxb_dom_node_t *cur = node; cur != NULL; cur = nl_node_order_next(node, cur)) {
+    count++;
+  }
+  uintptr_t step = (high - low) / (count + 1);
+  if (step == 0) {
+    nl_node_order_invalidate(node->owner_document);
+    return;
+  }
+  if (step > NL_ORDER_GAP) {
+    step = NL_ORDER_GAP;
+  }
+
+  uintptr_t position = low;
+  for (lxb_dom_node_t *cur = node; cur != NULL; cur = nl_node_order_next(node, cur)) {
+    position += step;
+    cur->user = (void *)(tag | position);
+  }
+}
+
+/**
+ * Compare the positions of +node1+ and +node2+ in document order, in O(1)
+ * when both have a valid key.
+ *
+ * @return A negative number if +node1+ comes first, 0 if they are the same
+ *   node, a positive number otherwise.
+ */
+int
+nl_node_order_compare(lxb_dom_node_t *node1, lxb_dom_node_t *node2)
+{
+  if (node1 == node2) {
+    return 0;
+  }
+  if (node1->owner_document == node2->owner_document && nl_node_order_known(node1) && nl_node_order_known(node2)) {
+    return (uintptr_t)node1->user < (uintptr_t)node2->user ? -1 : 1;
+  }
+  return -nl_xmlXPathCmpNodes(node1, node2);
+}
+
+/**
+ * Renumber the document of +nodes+ if any of them lacks a valid key and
+ * belongs to the tree of the document. Nodes of detached trees are compared
+ * by walking the tree instead.
+ */
+void
+nl_node_order_prepare(lxb_dom_node_t **nodes, size_t length)
+{
+  if (length < 2) {
+    return;
+  }
+  for (size_t i = 0; i < length; i++) {
+    lxb_dom_node_t *node = nodes[i];
+    if (node->type == XML_NAMESPACE_DECL || node->type == LXB_DOM_NODE_TYPE_ATTRIBUTE) {
+      continue;
+    }
+    if (!nl_node_order_known(node)) {
+      if (node->owner_document != NULL && nl_node_order_root(node) == &node->owner_document->node) {
+        nl_node_order_assign(node->owner_document);
+      }
+      return;
+    }
+  }
+}
+
+/**
+ * Sort +nodes+ in document order.
+ */
+void
+nl_node_order_sort(lxb_dom_node_t **nodes, size_t length)
+{
+  nl_node_order_prepare(nodes, length);
+  nl_node_order_tim_sort(nodes, length);
+}
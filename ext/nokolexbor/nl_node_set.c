@@ -3,27 +3,74 @@
 extern VALUE mNokolexbor;
 extern VALUE cNokolexborNode;
 VALUE cNokolexborNodeSet;
-extern rb_data_type_t nl_document_type;
 
-lxb_status_t nl_node_find(VALUE self, VALUE selector, lxb_selectors_cb_f cb, void *ctx);
-void nl_sort_nodes_if_necessary(VALUE selector, lxb_dom_document_t *doc, lexbor_array_t *array);
+lxb_status_t nl_node_find(VALUE self, VALUE selector, lxb_selectors_cb_f cb, void *ctx, bool *in_order);
 lxb_status_t nl_node_at_css_callback(lxb_dom_node_t *node, lxb_css_selector_specificity_t *spec, void *ctx);
 lxb_status_t nl_node_css_callback(lxb_dom_node_t *node, lxb_css_selector_specificity_t *spec, void *ctx);
 
+// Arrays shorter than this are checked for duplicates by a linear scan
+#define NL_NODE_SET_INDEX_THRESHOLD 32
+
+/**
+ * Append +value+ to +set+ unless it is already there, in which case
+ * LXB_STATUS_STOPPED is returned.
+ */
 lxb_status_t
-lexbor_array_push_unique(lexbor_array_t *array, void *value)
+nl_node_set_push_unique(nl_node_set_t *set, void *value)
 {
-  for (size_t i = 0; i < array->length; i++)
-    if (array->list[i] == value)
-      return LXB_STATUS_STOPPED;
+  lexbor_array_t *array = set->array;
+
+  if (set->index == NULL) {
+    if (array->length < NL_NODE_SET_INDEX_THRESHOLD) {
+      for (size_t i = 0; i < array->length; i++)
+        if (array->list[i] == value)
+          return LXB_STATUS_STOPPED;
+
+      return lexbor_array_push(array, value);
+    }
+
+    set->index = st_init_numtable_with_size(array->length * 2);
+    for (size_t i = 0; i < array->length; i++) {
+      st_insert(set->index, (st_data_t)array->list[i], 0);
+    }
+  }
+
+  if (st_lookup(set->index, (st_data_t)value, NULL)) {
+    return LXB_STATUS_STOPPED;
+  }
 
-  return lexbor_array_push(array, value);
+  lxb_status_t status = lexbor_array_push(array, value);
+  if (status == LXB_STATUS_OK) {
+    st_insert(set->index, (st_data_t)value, 0);
+  }
+  return status;
+}
+
+void
+nl_node_set_index_destroy(nl_node_set_t *set)
+{
+  if (set->index != NULL) {
+    st_free_table(set->index);
+    set->index = NULL;
+  }
 }
 
 static void
-free_nl_node_set(lexbor_array_t *array)
+free_nl_node_set(nl_node_set_t *set)
 {
-  lexbor_array_destroy(array, true);
+  lexbor_array_destroy(set->array, true);
+  nl_node_set_index_destroy(set);
+  ruby_xfree(set);
+}
+
+static size_t
+memsize_nl_node_set(const nl_node_set_t *set)
+{
+  size_t size = sizeof(nl_node_set_t) + sizeof(lexbor_array_t) + set->array->size * sizeof(void *);
+  if (set->index != NULL) {
+    size += st_memsize(set->index);
+  }
+  return size;
 }
 
 const rb_data_type_t nl_node_set_type = {
@@ -31,25 +78,51 @@ const rb_data_type_t nl_node_set_type = {
     {
         0,
         (RUBY_DATA_FUNC)free_nl_node_set,
+        (size_t(*)(const void *))memsize_nl_node_set,
     },
     0,
     0,
     RUBY_TYPED_FREE_IMMEDIATELY,
 };
 
+static nl_node_set_t *
+nl_rb_node_set_data_unwrap(VALUE rb_node_set)
+{
+  nl_node_set_t *set;
+  TypedData_Get_Struct(rb_node_set, nl_node_set_t, &nl_node_set_type, set);
+
+  VALUE rb_document = rb_iv_get(rb_node_set, "@document");
+  if (rb_typeddata_is_kind_of(rb_document, &nl_document_type)) {
+    size_t generation = nl_rb_document_data_unwrap(rb_document)->generation;
+    if (set->array->length == 0) {
+      set->generation = generation;
+    } else if (set->generation != generation) {
+      // The nodes were freed by Document#reparse or Document#release!
+      rb_raise(rb_eRuntimeError, "NodeSet refers to nodes of a reparsed or released document");
+    }
+  }
+  return set;
+}
+
 lexbor_array_t *
 nl_rb_node_set_unwrap(VALUE rb_node_set)
 {
-  lexbor_array_t *array;
-  TypedData_Get_Struct(rb_node_set, lexbor_array_t, &nl_node_set_type, array);
-  return array;
+  return nl_rb_node_set_data_unwrap(rb_node_set)->array;
+}
+
+static VALUE
+nl_node_set_wrap(lexbor_array_t *array)
+{
+  nl_node_set_t *set;
+  VALUE ret = TypedData_Make_Struct(cNokolexborNodeSet, nl_node_set_t, &nl_node_set_type, set);
+  set->array = array;
+  return ret;
 }
 
 static VALUE
 nl_node_set_allocate(VALUE klass)
 {
-  lexbor_array_t *array = lexbor_array_create();
-  return TypedData_Wrap_Struct(cNokolexborNodeSet, &nl_node_set_type, array);
+  return nl_node_set_wrap(lexbor_array_create());
 }
 
 VALUE
@@ -58,8 +131,11 @@ nl_rb_node_set_create_with_data(lexbor_array_t *array, VALUE rb_document)
   if (array == NULL) {
     array = lexbor_array_create();
   }
-  VALUE ret = TypedData_Wrap_Struct(cNokolexborNodeSet, &nl_node_set_type, array);
+  VALUE ret = nl_node_set_wrap(array);
   rb_iv_set(ret, "@document", rb_document);
+  if (rb_typeddata_is_kind_of(rb_document, &nl_document_type)) {
+    ((nl_node_set_t *)RTYPEDDATA_DATA(ret))->generation = nl_rb_document_data_unwrap(rb_document)->generation;
+  }
   return ret;
 }
 
@@ -87,10 +163,10 @@ nl_node_set_length(VALUE self)
 static VALUE
 nl_node_set_push(VALUE self, VALUE rb_node)
 {
-  lexbor_array_t *array = nl_rb_node_set_unwrap(self);
+  nl_node_set_t *set = nl_rb_node_set_data_unwrap(self);
   lxb_dom_node_t *node = nl_rb_node_unwrap(rb_node);
 
-  lxb_status_t status = lexbor_array_push_unique(array, node);
+  lxb_status_t status = nl_node_set_push_unique(set, node);
   if (status != LXB_STATUS_OK && status != LXB_STATUS_STOPPED) {
     nl_raise_lexbor_error(status);
   }
@@ -111,9 +187,15 @@ nl_node_set_push(VALUE self, VALUE rb_node)
 static VALUE
 nl_node_set_delete(VALUE self, VALUE rb_node)
 {
-  lexbor_array_t *array = nl_rb_node_set_unwrap(self);
+  nl_node_set_t *set = nl_rb_node_set_data_unwrap(self);
+  lexbor_array_t *array = set->array;
   lxb_dom_node_t *node = nl_rb_node_unwrap(rb_node);
 
+  st_data_t key = (st_data_t)node;
+  if (set->index != NULL && !st_delete(set->index, &key, NULL)) {
+    return Qnil;
+  }
+
   size_t i;
   for (i = 0; i < array->length; i++)
     if (array->list[i] == node) {
@@ -137,9 +219,14 @@ nl_node_set_delete(VALUE self, VALUE rb_node)
 static VALUE
 nl_node_set_is_include(VALUE self, VALUE rb_node)
 {
-  lexbor_array_t *array = nl_rb_node_set_unwrap(self);
+  nl_node_set_t *set = nl_rb_node_set_data_unwrap(self);
+  lexbor_array_t *array = set->array;
   lxb_dom_node_t *node = nl_rb_node_unwrap(rb_node);
 
+  if (set->index != NULL) {
+    return st_lookup(set->index, (st_data_t)node, NULL) ? Qtrue : Qfalse;
+  }
+
   for (size_t i = 0; i < array->length; i++)
     if (array->list[i] == node) {
       return Qtrue;
@@ -293,9 +380,11 @@ nl_node_set_union(VALUE self, VALUE other)
   memcpy(new_array->list, self_array->list, sizeof(lxb_dom_node_t *) * self_array->length);
   new_array->length = self_array->length;
 
+  nl_node_set_t set = {new_array, NULL};
   for (size_t i = 0; i < other_array->length; i++) {
-    lexbor_array_push_unique(new_array, other_array->list[i]);
+    nl_node_set_push_unique(&set, other_array->list[i]);
   }
+  nl_node_set_index_destroy(&set);
 
   return nl_rb_node_set_create_with_data(new_array, nl_rb_document_get(self));
 }
@@ -359,7 +448,7 @@ nl_node_set_difference(VALUE self, VALUE other)
 }
 
 static lxb_status_t
-nl_node_set_find(VALUE self, VALUE selector, lxb_selectors_cb_f cb, void *ctx)
+nl_node_set_find(VALUE self, VALUE selector, lxb_selectors_cb_f cb, void *ctx, bool *in_order)
 {
   lxb_dom_document_t *doc = nl_rb_document_unwrap(nl_rb_document_get(self));
   if (doc == NULL) {
@@ -395,8 +484,9 @@ nl_node_set_find(VALUE self, VALUE selector, lxb_selectors_cb_f cb, void *ctx)
   }
   VALUE rb_frag = nl_rb_node_create(&frag->node, nl_rb_document_get(self));
 
-  lxb_status_t status = nl_node_find(rb_frag, selector, cb, ctx);
+  lxb_status_t status = nl_node_find(rb_frag, selector, cb, ctx, in_order);
 
+  nl_document_node_cache_delete(nl_rb_document_get(self), &frag->node);
   lxb_dom_document_fragment_interface_destroy(frag);
   // Restore original node data
   for (size_t i = 0; i < array->length; i++) {
@@ -415,9 +505,9 @@ static VALUE
 nl_node_set_at_css(VALUE self, VALUE selector)
 {
   lexbor_array_t *array = lexbor_array_create();
-  lxb_dom_document_t *doc = nl_rb_document_unwrap(nl_rb_document_get(self));
+  bool in_order;
 
-  lxb_status_t status = nl_node_set_find(self, selector, nl_node_at_css_callback, array);
+  lxb_status_t status = nl_node_set_find(self, selector, nl_node_at_css_callback, array, &in_order);
 
   if (status != LXB_STATUS_OK) {
     lexbor_array_destroy(array, true);
@@ -429,7 +519,9 @@ nl_node_set_at_css(VALUE self, VALUE selector)
     return Qnil;
   }
 
-  nl_sort_nodes_if_necessary(selector, doc, array);
+  if (!in_order) {
+    nl_node_order_sort((lxb_dom_node_t **)array->list, array->length);
+  }
 
   VALUE ret = nl_rb_node_create(array->list[0], nl_rb_document_get(self));
 
@@ -445,15 +537,19 @@ static VALUE
 nl_node_set_css(VALUE self, VALUE selector)
 {
   lexbor_array_t *array = lexbor_array_create();
-  lxb_dom_document_t *doc = nl_rb_document_unwrap(nl_rb_document_get(self));
+  bool in_order;
 
-  lxb_status_t status = nl_node_set_find(self, selector, nl_node_css_callback, array);
+  nl_node_set_t set = {array, NULL};
+  lxb_status_t status = nl_node_set_find(self, selector, nl_node_css_callback, &set, &in_order);
+  nl_node_set_index_destroy(&set);
   if (status != LXB_STATUS_OK) {
     lexbor_array_destroy(array, true);
     nl_raise_lexbor_error(status);
   }
 
-  nl_sort_nodes_if_necessary(selector, doc, array);
+  if (!in_order) {
+    nl_node_order_sort((lxb_dom_node_t **)array->list, array->length);
+  }
 
   return nl_rb_node_set_create_with_data(array, nl_rb_document_get(self));
 }
@@ -0,0 +1,79 @@
+#include "nokolexbor.h"
+
+VALUE cNokolexborSelector;
+extern VALUE mNokolexbor;
+
+static void
+free_nl_selector(lxb_css_selector_list_t *list)
+{
+  lxb_css_selector_list_destroy_memory(list);
+}
+
+const rb_data_type_t nl_selector_type = {
+    "Nokolexbor::Selector",
+    {
+        0,
+        (RUBY_DATA_FUNC)free_nl_selector,
+    },
+    0,
+    0,
+    RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+lxb_css_selector_list_t *
+nl_rb_selector_unwrap(VALUE rb_selector)
+{
+  lxb_css_selector_list_t *list;
+  TypedData_Get_Struct(rb_selector, lxb_css_selector_list_t, &nl_selector_type, list);
+  return list;
+}
+
+/**
+ * call-seq:
+ *   new(selector) -> Selector
+ *
+ * Compile the CSS +selector+ once so that it can be reused by
+ * {Node#css}, {Node#at_css}, {Node#matches?}, {NodeSet#css} and
+ * {NodeSet#at_css} without being parsed again.
+ *
+ * A Selector is immutable and can be shared between threads.
+ *
+ * @example
+ *   TITLE = Nokolexbor::Selector.new('h3, .title')
+ *   doc.css(TITLE)
+ *
+ * @param selector [String]
+ *
+ * @return [Selector]
+ */
+static VALUE
+nl_selector_new(VALUE klass, VALUE rb_selector)
+{
+  const char *selector_c = StringValuePtr(rb_selector);
+  size_t selector_len = RSTRING_LEN(rb_selector);
+  lxb_status_t status;
+
+  lxb_css_selector_list_t *list = nl_css_selectors_parse((const lxb_char_t *)selector_c, selector_len, &status);
+  if (list == NULL) {
+    nl_raise_lexbor_error(status);
+  }
+
+  VALUE self = TypedData_Wrap_Struct(klass, &nl_selector_type, list);
+  rb_iv_set(self, "@source", rb_str_new_frozen(rb_selector));
+  rb_obj_freeze(self);
+
+  return self;
+}
+
+void Init_nl_selector(void)
+{
+  cNokolexborSelector = rb_define_class_under(mNokolexbor, "Selector", rb_cObject);
+  rb_undef_alloc_func(cNokolexborSelector);
+
+  rb_define_singleton_method(cNokolexborSelector, "new", nl_selector_new, 1);
+  /* @return [String] The source of this selector. */
+  rb_define_attr(cNokolexborSelector, "source", 1, 0);
+
+  rb_define_alias(cNokolexborSelector, "to_s", "source");
+  rb_define_alias(cNokolexborSelector, "to_str", "source");
+}
@@ -1,3 +1,4 @@
+#include "config.h"
 #include "libxml.h"
 #include "libxml/globals.h"
 #include "libxml/parserInternals.h"
@@ -7,13 +8,23 @@
 #include <ruby.h>
 #include <ruby/util.h>
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+pthread_key_t p_key_xpath_cache;
+pthread_key_t p_key_xpath_context;
+#endif
+
 #define RBSTR_OR_QNIL(_str) (_str ? rb_utf8_str_new_cstr(_str) : Qnil)
 
+// Maximum number of compiled expressions kept per thread by XPathContext#evaluate
+#define NL_XPATH_CACHE_SIZE 256
+
 extern VALUE mNokolexbor;
 extern VALUE cNokolexborNodeSet;
 VALUE cNokolexborXpathContext;
 VALUE mNokolexborXpath;
 VALUE cNokolexborXpathSyntaxError;
+VALUE cNokolexborXpathExpression;
 
 static const xmlChar *NOKOGIRI_PREFIX = (const xmlChar *)"nokogiri";
 static const xmlChar *NOKOGIRI_URI = (const xmlChar *)"http://www.nokogiri.org/default_ns/ruby/extensions_functions";
@@ -256,30 +267,98 @@ nl_xpath_generic_exception_pusher(void *ctx, const char *msg, ...)
   rb_ary_push(rb_errors, rb_exception);
 }
 
+static void
+free_xpath_expression(xmlXPathCompExprPtr comp)
+{
+  nl_xmlXPathFreeCompExpr(comp);
+}
+
+const rb_data_type_t nl_xpath_expression_type = {
+    "Nokolexbor::XPath::Expression",
+    {
+        0,
+        (RUBY_DATA_FUNC)free_xpath_expression,
+    },
+    0,
+    0,
+    RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static xmlXPathCompExprPtr
+nl_rb_xpath_expression_unwrap(VALUE rb_expression)
+{
+  xmlXPathCompExprPtr comp;
+  TypedData_Get_Struct(rb_expression, xmlXPathCompExpr, &nl_xpath_expression_type, comp);
+  return comp;
+}
+
+#ifdef HAVE_PTHREAD_H
+static int
+free_xpath_cache_entry(st_data_t key, st_data_t value, st_data_t arg)
+{
+  ruby_xfree((void *)key);
+  nl_xmlXPathFreeCompExpr((xmlXPathCompExprPtr)value);
+  return ST_DELETE;
+}
+#endif
+
 /*
- * call-seq:
- *  evaluate(search_path, handler = nil)
- *
- * Evaluate the +search_path+ returning an XML::XPath object.
+ * Get the compiled form of +query+ from the per-thread cache, compiling it
+ * on a miss. Sets +owned+ when the caller has to free the result.
  */
+static xmlXPathCompExprPtr
+nl_xpath_compile_cached(const xmlChar *query, bool *owned)
+{
+  xmlXPathCompExprPtr comp;
+  *owned = false;
+
+#ifdef HAVE_PTHREAD_H
+  st_table *cache = (st_table *)pthread_getspecific(p_key_xpath_cache);
+  if (cache == NULL) {
+    cache = st_init_strtable();
+    pthread_setspecific(p_key_xpath_cache, cache);
+  }
+
+  st_data_t value;
+  if (st_lookup(cache, (st_data_t)query, &value)) {
+    return (xmlXPathCompExprPtr)value;
+  }
+#endif
+
+  comp = nl_xmlXPathCompile(query);
+  if (comp == NULL) {
+    return NULL;
+  }
+
+#ifdef HAVE_PTHREAD_H
+  if (cache->num_entries >= NL_XPATH_CACHE_SIZE) {
+    st_foreach(cache, free_xpath_cache_entry, 0);
+  }
+  // Keyed by a copy of the query, comp->expr is NULL for streamed paths
+  st_insert(cache, (st_data_t)ruby_strdup((const char *)query), (st_data_t)comp);
+#else
+  *owned = true;
+#endif
+
+  return comp;
+}
+
 static VALUE
-nl_xpath_context_evaluate(int argc, VALUE *argv, VALUE self)
+nl_xpath_evaluate(xmlXPathContextPtr ctx, VALUE search_path, VALUE rb_document)
 {
-  VALUE search_path, xpath_handler;
   VALUE retval = Qnil;
-  xmlXPathContextPtr ctx;
   xmlXPathObjectPtr xpath;
-  xmlChar *query;
+  xmlXPathCompExprPtr comp = NULL;
+  xmlChar *query = NULL;
+  bool owned = false;
   VALUE errors = rb_ary_new();
 
-  Data_Get_Struct(self, xmlXPathContext, ctx);
-
-  if (rb_scan_args(argc, argv, "11", &search_path, &xpath_handler) == 1) {
-    xpath_handler = Qnil;
+  if (rb_obj_is_kind_of(search_path, cNokolexborXpathExpression)) {
+    comp = nl_rb_xpath_expression_unwrap(search_path);
+  } else {
+    query = (xmlChar *)StringValueCStr(search_path);
   }
 
-  query = (xmlChar *)StringValueCStr(search_path);
-
   // if (Qnil != xpath_handler) {
   //   /* FIXME: not sure if this is the correct place to shove private data. */
   //   ctx->userData = (void *)xpath_handler;
@@ -289,7 +368,13 @@ nl_xpath_context_evaluate(int argc, VALUE *argv, VALUE self)
   nl_xmlSetStructuredErrorFunc((void *)errors, nl_xpath_error_array_pusher);
   nl_xmlSetGenericErrorFunc((void *)errors, nl_xpath_generic_exception_pusher);
 
-  xpath = nl_xmlXPathEvalExpression(query, ctx);
+  if (query != NULL) {
+    comp = nl_xpath_compile_cached(query, &owned);
+  }
+  xpath = comp != NULL ? nl_xmlXPathCompiledEval(comp, ctx) : NULL;
+  if (owned) {
+    nl_xmlXPathFreeCompExpr(comp);
+  }
 
   nl_xmlSetStructuredErrorFunc(NULL, NULL);
   nl_xmlSetGenericErrorFunc(NULL, NULL);
@@ -299,7 +384,7 @@ nl_xpath_context_evaluate(int argc, VALUE *argv, VALUE self)
     rb_exc_raise(rb_ary_entry(errors, 0));
   }
 
-  retval = xpath2ruby(xpath, ctx, nl_rb_document_get(self));
+  retval = xpath2ruby(xpath, ctx, rb_document);
   if (retval == Qundef) {
     retval = rb_funcall(cNokolexborNodeSet, rb_intern("new"), 1, rb_ary_new());
   }
@@ -311,19 +396,34 @@ nl_xpath_context_evaluate(int argc, VALUE *argv, VALUE self)
 
 /*
  * call-seq:
- *  new(node)
+ *  evaluate(search_path, handler = nil)
  *
- * Create a new XPathContext with +node+ as the reference point.
+ * Evaluate the +search_path+ returning an XML::XPath object.
+ *
+ * +search_path+ is either a String or an {XPath::Expression}. Strings are
+ * compiled once and then reused from a bounded per-thread cache.
  */
 static VALUE
-nl_xpath_context_new(VALUE klass, VALUE rb_node)
+nl_xpath_context_evaluate(int argc, VALUE *argv, VALUE self)
 {
+  VALUE search_path, xpath_handler;
   xmlXPathContextPtr ctx;
-  VALUE self;
 
-  lxb_dom_node_t *node = nl_rb_node_unwrap(rb_node);
+  Data_Get_Struct(self, xmlXPathContext, ctx);
+
+  if (rb_scan_args(argc, argv, "11", &search_path, &xpath_handler) == 1) {
+    xpath_handler = Qnil;
+  }
+  // Raises if the node has been freed since the context was created
+  ctx->node = nl_rb_node_unwrap(rb_iv_get(self, "@node"));
+
+  return nl_xpath_evaluate(ctx, search_path, nl_rb_document_get(self));
+}
 
-  ctx = nl_xmlXPathNewContext(node->owner_document);
+static xmlXPathContextPtr
+nl_xpath_context_create(lxb_dom_node_t *node)
+{
+  xmlXPathContextPtr ctx = nl_xmlXPathNewContext(node->owner_document);
   ctx->node = node;
 
   nl_xmlXPathRegisterNs(ctx, NOKOGIRI_PREFIX, NOKOGIRI_URI);
@@ -333,14 +433,134 @@ nl_xpath_context_new(VALUE klass, VALUE rb_node)
   nl_xmlXPathRegisterFuncNS(ctx, (const xmlChar *)"local-name-is", NOKOGIRI_BUILTIN_URI,
                             xpath_builtin_local_name_is);
 
+  return ctx;
+}
+
+/*
+ * call-seq:
+ *  new(node)
+ *
+ * Create a new XPathContext with +node+ as the reference point.
+ */
+static VALUE
+nl_xpath_context_new(VALUE klass, VALUE rb_node)
+{
+  VALUE self;
+  lxb_dom_node_t *node = nl_rb_node_unwrap(rb_node);
+  xmlXPathContextPtr ctx = nl_xpath_context_create(node);
+
   self = Data_Wrap_Struct(klass, 0, free_xml_xpath_context, ctx);
   rb_iv_set(self, "@document", nl_rb_document_get(rb_node));
+  rb_iv_set(self, "@node", rb_node);
 
   return self;
 }
 
+/*
+ * call-seq:
+ *  evaluate_on(node, search_path)
+ *
+ * Evaluate the +search_path+ with +node+ as the reference point, without
+ * registering extra namespaces or variables. Used by {Node#xpath}.
+ *
+ * The XPath context, with the builtin namespaces and functions registered
+ * and its object cache enabled, is created once per thread and re-pointed
+ * at +node+ for every query.
+ */
+static VALUE
+nl_xpath_context_s_evaluate_on(VALUE klass, VALUE rb_node, VALUE search_path)
+{
+  lxb_dom_node_t *node = nl_rb_node_unwrap(rb_node);
+  VALUE rb_document = nl_rb_document_get(rb_node);
+
+#ifdef HAVE_PTHREAD_H
+  xmlXPathContextPtr ctx = (xmlXPathContextPtr)pthread_getspecific(p_key_xpath_context);
+  if (ctx == NULL) {
+    ctx = nl_xpath_context_create(node);
+    nl_xmlXPathContextSetCache(ctx, 1, -1, 0);
+    pthread_setspecific(p_key_xpath_context, ctx);
+  }
+
+  ctx->doc = node->owner_document;
+  ctx->node = node;
+  ctx->contextSize = -1;
+  ctx->proximityPosition = -1;
+  ctx->depth = 0;
+
+  return nl_xpath_evaluate(ctx, search_path, rb_document);
+#else
+  VALUE rb_ctx = nl_xpath_context_new(klass, rb_node);
+  return nl_xpath_context_evaluate(1, &search_path, rb_ctx);
+#endif
+}
+
+/*
+ * call-seq:
+ *  compile(expression) -> XPath::Expression
+ *
+ * Compile the XPath +expression+ once, so that it can be evaluated by
+ * {Node#xpath}, {Node#at_xpath} and {XPathContext#evaluate} against any
+ * node without being parsed again.
+ *
+ * @example
+ *   LINKS = Nokolexbor::XPath.compile('.//a[@href]')
+ *   node.xpath(LINKS)
+ *
+ * @return [XPath::Expression]
+ */
+static VALUE
+nl_xpath_compile(VALUE self, VALUE rb_expression)
+{
+  xmlXPathCompExprPtr comp;
+  xmlChar *query = (xmlChar *)StringValueCStr(rb_expression);
+  VALUE errors = rb_ary_new();
+
+  nl_xmlSetStructuredErrorFunc((void *)errors, nl_xpath_error_array_pusher);
+  nl_xmlSetGenericErrorFunc((void *)errors, nl_xpath_generic_exception_pusher);
+
+  comp = nl_xmlXPathCompile(query);
+
+  nl_xmlSetStructuredErrorFunc(NULL, NULL);
+  nl_xmlSetGenericErrorFunc(NULL, NULL);
+
+  if (comp == NULL) {
+    rb_exc_raise(rb_ary_entry(errors, 0));
+  }
+
+  VALUE rb_comp = TypedData_Wrap_Struct(cNokolexborXpathExpression, &nl_xpath_expression_type, comp);
+  rb_iv_set(rb_comp, "@source", rb_str_new_frozen(rb_expression));
+  rb_obj_freeze(rb_comp);
+
+  return rb_comp;
+}
+
+#ifdef HAVE_PTHREAD_H
+static void
+free_xpath_cache(void *data)
+{
+  st_table *cache = (st_table *)data;
+  if (cache != NULL) {
+    st_foreach(cache, free_xpath_cache_entry, 0);
+    st_free_table(cache);
+  }
+}
+
+static void
+free_pooled_xpath_context(void *data)
+{
+  if (data != NULL) {
+    nl_xmlXPathFreeContext((xmlXPathContextPtr)data);
+  }
+}
+#endif
+
 void Init_nl_xpath_context(void)
 {
+#ifdef HAVE_PTHREAD_H
+  pthread_key_create(&p_key_xpath_cache, free_xpath_cache);
+  pthread_key_create(&p_key_xpath_context, free_pooled_xpath_context);
+#endif
+
 #ifndef NOKOLEXBOR_ASAN
   nl_xmlMemSetup((xmlFreeFunc)ruby_xfree, (xmlMallocFunc)ruby_xmalloc, (xmlReallocFunc)ruby_xrealloc, ruby_strdup);
 #else
@@ -351,9 +571,18 @@ void Init_nl_xpath_context(void)
   mNokolexborXpath = rb_define_module_under(mNokolexbor, "XPath");
   cNokolexborXpathSyntaxError = rb_define_class_under(mNokolexborXpath, "SyntaxError", rb_eStandardError);
 
+  cNokolexborXpathExpression = rb_define_class_under(mNokolexborXpath, "Expression", rb_cObject);
+
   rb_undef_alloc_func(cNokolexborXpathContext);
+  rb_undef_alloc_func(cNokolexborXpathExpression);
+
+  rb_define_singleton_method(mNokolexborXpath, "compile", nl_xpath_compile, 1);
+  /* @return [String] The source of this expression. */
+  rb_define_attr(cNokolexborXpathExpression, "source", 1, 0);
+  rb_define_alias(cNokolexborXpathExpression, "to_s", "source");
 
   rb_define_singleton_method(cNokolexborXpathContext, "new", nl_xpath_context_new, 1);
+  rb_define_singleton_method(cNokolexborXpathContext, "evaluate_on", nl_xpath_context_s_evaluate_on, 2);
 
   rb_define_method(cNokolexborXpathContext, "evaluate", nl_xpath_context_evaluate, -1);
   rb_define_method(cNokolexborXpathContext, "register_variable", nl_xpath_context_register_variable, 2);
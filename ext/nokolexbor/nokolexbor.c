@@ -19,4 +19,6 @@ void Init_nokolexbor(void)
   Init_nl_document_fragment();
   Init_nl_attribute();
   Init_nl_xpath_context();
+  Init_nl_selector();
+  Init_nl_css_xpath();
 }
@@ -2,6 +2,7 @@
 #define __NOKOLEXBOR_RUBY_H__
 
 #include <ruby.h>
+#include <ruby/st.h>
 
 #include <lexbor/css/css.h>
 #include <lexbor/html/html.h>
@@ -9,6 +10,71 @@
 
 extern VALUE cNokolexborDocument;
 
+typedef struct {
+  const lxb_char_t *data;
+  size_t length;
+  /* Offset of +data+ in the whole input */
+  size_t location;
+} nl_parse_chunk_t;
+
+/* Kinds of nodes left out of the tree while parsing, see Document.parse */
+#define NL_PARSE_SKIP_COMMENTS (1 << 0)
+#define NL_PARSE_SKIP_BLANK_TEXT (1 << 1)
+#define NL_PARSE_SKIP_SCRIPT_CONTENT (1 << 2)
+
+typedef struct {
+  int options;
+  lxb_html_tree_t *tree;
+  /* Callback of the tree builder the tokens that are kept are passed to */
+  lxb_html_tokenizer_token_f callback;
+  void *ctx;
+} nl_token_filter_t;
+
+typedef struct {
+  /* Chunks the tokenizer may still point into, from the one holding the
+     begin of the current token to the last one fed */
+  nl_parse_chunk_t *chunks;
+  size_t length;
+  size_t capacity;
+  /* Strings of +chunks+, kept alive until they are dropped */
+  VALUE rb_chunks;
+  /* Bytes fed so far */
+  size_t location;
+  nl_token_filter_t filter;
+} nl_parse_chunks_t;
+
+typedef struct {
+  lxb_html_document_t *document;
+  /* State of a parse in chunks, NULL unless the document is being parsed */
+  nl_parse_chunks_t *parse;
+  /* Bumped by every tree mutation made through the Ruby API */
+  size_t mutations;
+  /* Bumped when all nodes are freed by Document#reparse or #release! */
+  size_t generation;
+  /* Set while Document#reparse rebuilds the tree, which it may do without
+     the GVL, the document can't be used by other threads meanwhile */
+  bool reparsing;
+  /* Memoized css results, NULL unless enabled by Document#css_cache= */
+  st_table *css_cache;
+  size_t css_cache_mutations;
+  /* Wrappers handed out for the nodes of this document, keyed by node */
+  st_table *node_cache;
+} nl_document_t;
+
+typedef struct {
+  lxb_dom_node_t *node;
+  /* The Document owning +node+, kept alive by the wrapper */
+  VALUE rb_document;
+} nl_node_t;
+
+typedef struct {
+  lexbor_array_t *array;
+  /* Set of the nodes in +array+, built once it outgrows a linear scan */
+  st_table *index;
+  /* Generation of the document the nodes of +array+ belong to */
+  size_t generation;
+} nl_node_set_t;
+
 void Init_nl_error(void);
 void Init_nl_document(void);
 void Init_nl_node(void);
@@ -20,27 +86,81 @@ void Init_nl_node_set(void);
 void Init_nl_document_fragment(void);
 void Init_nl_attribute(void);
 void Init_nl_xpath_context(void);
+void Init_nl_selector(void);
+void Init_nl_css_xpath(void);
 
 void nl_raise_lexbor_error(lxb_status_t error);
 lxb_dom_node_t *nl_rb_node_unwrap(VALUE rb_node);
 VALUE nl_rb_node_create(lxb_dom_node_t *node, VALUE rb_document);
 VALUE nl_rb_node_set_create_with_data(lexbor_array_t *array, VALUE rb_document);
 
+extern const rb_data_type_t nl_node_type;
+extern const rb_data_type_t nl_document_type;
+
 lxb_inline VALUE nl_rb_document_get(VALUE rb_node_or_doc)
 {
-  if (rb_obj_is_kind_of(rb_node_or_doc, cNokolexborDocument)) {
+  if (rb_typeddata_is_kind_of(rb_node_or_doc, &nl_node_type)) {
+    return ((nl_node_t *)RTYPEDDATA_DATA(rb_node_or_doc))->rb_document;
+  }
+  if (rb_typeddata_is_kind_of(rb_node_or_doc, &nl_document_type)) {
     return rb_node_or_doc;
   }
   return rb_iv_get(rb_node_or_doc, "@document");
 }
 
 lxb_dom_document_t *nl_rb_document_unwrap(VALUE rb_doc);
+nl_document_t *nl_rb_document_data_unwrap(VALUE rb_doc);
+void nl_document_mutated(VALUE rb_node_or_doc);
+bool nl_document_is_parsing(VALUE rb_doc);
+VALUE nl_document_node_cache_get(VALUE rb_doc, lxb_dom_node_t *node);
+void nl_document_node_cache_set(VALUE rb_doc, lxb_dom_node_t *node, VALUE rb_node);
+void nl_document_node_cache_delete(VALUE rb_doc, lxb_dom_node_t *node);
+lexbor_array_t *nl_document_css_cache_get(nl_document_t *doc, lxb_dom_node_t *node, VALUE selector, bool first);
+void nl_document_css_cache_set(nl_document_t *doc, lxb_dom_node_t *node, VALUE selector, bool first, lexbor_array_t *array);
 lexbor_array_t *nl_rb_node_set_unwrap(VALUE rb_node_set);
+lxb_css_selector_list_t *nl_rb_selector_unwrap(VALUE rb_selector);
+
+lxb_css_selector_list_t *
+nl_css_selectors_parse(const lxb_char_t *selector, size_t selector_len, lxb_status_t *status);
 
 const lxb_char_t *
 lxb_dom_node_name_qualified(lxb_dom_node_t *node, size_t *len);
 
+/* Exported from lexbor by patches/0008-lexbor-expose-relative-chain-match.patch */
+bool
+lxb_selectors_match_chain_rtl(lxb_selectors_t *selectors, lxb_css_selector_t *selector, lxb_dom_node_t *node,
+                              lxb_dom_node_t *root);
+
 lxb_status_t
-lexbor_array_push_unique(lexbor_array_t *array, void *value);
+nl_node_set_push_unique(nl_node_set_t *set, void *value);
+void nl_node_set_index_destroy(nl_node_set_t *set);
+
+/* Document order keys kept in node->user, see nl_node_order.c */
+#define NL_ORDER_EPOCH_BITS (sizeof(uintptr_t) >= 8 ? 16 : 8)
+#define NL_ORDER_POSITION_BITS (sizeof(uintptr_t) * 8 - NL_ORDER_EPOCH_BITS)
+#define NL_ORDER_POSITION_MASK (((uintptr_t)1 << NL_ORDER_POSITION_BITS) - 1)
+#define NL_ORDER_GAP (sizeof(uintptr_t) >= 8 ? (uintptr_t)1 << 16 : (uintptr_t)1 << 2)
+#define NL_ORDER_STALE ((uintptr_t)1)
+
+/**
+ * Whether +node+ has a key that can be compared with those of the other
+ * nodes of its document.
+ */
+lxb_inline bool nl_node_order_known(const lxb_dom_node_t *node)
+{
+  uintptr_t key = (uintptr_t)node->user;
+  if (key == 0 || node->owner_document == NULL) {
+    return false;
+  }
+  uintptr_t epoch = (uintptr_t)node->owner_document->node.user;
+  return (epoch & NL_ORDER_POSITION_MASK) == 0 && (key & ~NL_ORDER_POSITION_MASK) == epoch;
+}
+
+long nl_node_order_assign(lxb_dom_document_t *doc);
+void nl_node_order_invalidate(lxb_dom_document_t *doc);
+void nl_node_order_inserted(lxb_dom_node_t *node);
+int nl_node_order_compare(lxb_dom_node_t *node1, lxb_dom_node_t *node2);
+void nl_node_order_prepare(lxb_dom_node_t **nodes, size_t length);
+void nl_node_order_sort(lxb_dom_node_t **nodes, size_t length);
 
 #endif
\ No newline at end of file
@@ -77,9 +77,8 @@
 * If defined, this will use xmlXPathCmpNodesExt() instead of
 * nl_xmlXPathCmpNodes(). The new function is optimized comparison of
 * non-element nodes; actually it will speed up comparison only if
-* nl_xmlXPathOrderDocElems() was called in order to index the elements of
-* a tree in document order; Libxslt does such an indexing, thus it will
-* benefit from this optimization.
+* the nodes of the tree have been given document order keys, which
+* nl_xmlXPathNodeSetSort() does through nl_node_order_prepare().
 */
 #define XP_OPTIMIZED_NON_ELEM_COMPARISON
 
@@ -164,7 +163,7 @@ xmlXPathCmpNodesExt(lxb_dom_node_t_ptr node1, lxb_dom_node_t_ptr node2) {
     int misc = 0, precedence1 = 0, precedence2 = 0;
     lxb_dom_node_t_ptr miscNode1 = NULL, miscNode2 = NULL;
     lxb_dom_node_t_ptr cur, root;
-    ptrdiff_t l1, l2;
+    uintptr_t l1, l2;
 
     if ((node1 == NULL) || (node2 == NULL))
 	return(-2);
@@ -172,18 +171,32 @@ xmlXPathCmpNodesExt(lxb_dom_node_t_ptr node1, lxb_dom_node_t_ptr node2) {
     if (node1 == node2)
 	return(0);
 
+    /*
+     * Every node of the tree is given a key, not only elements, see
+     * nl_node_order.c.
+     */
+    if ((node1->type != XML_NAMESPACE_DECL) &&
+	(node2->type != XML_NAMESPACE_DECL) &&
+	(node1->owner_document == node2->owner_document) &&
+	nl_node_order_known(node1) &&
+	nl_node_order_known(node2)) {
+	l1 = (uintptr_t) node1->user;
+	l2 = (uintptr_t) node2->user;
+	return(l1 < l2 ? 1 : -1);
+    }
+
     /*
      * a couple of optimizations which will avoid computations in most cases
      */
     switch (node1->type) {
 	case LXB_DOM_NODE_TYPE_ELEMENT:
 	    if (node2->type == LXB_DOM_NODE_TYPE_ELEMENT) {
-		if ((0 > (ptrdiff_t) node1->user) &&
-		    (0 > (ptrdiff_t) node2->user) &&
+		if (nl_node_order_known(node1) &&
+		    nl_node_order_known(node2) &&
 		    (node1->owner_document == node2->owner_document))
 		{
-		    l1 = -((ptrdiff_t) node1->user);
-		    l2 = -((ptrdiff_t) node2->user);
+		    l1 = (uintptr_t) node1->user;
+		    l2 = (uintptr_t) node2->user;
 		    if (l1 < l2)
 			return(1);
 		    if (l1 > l2)
@@ -228,7 +241,7 @@ xmlXPathCmpNodesExt(lxb_dom_node_t_ptr node1, lxb_dom_node_t_ptr node2) {
 		node1 = node1->parent;
 	    }
 	    if ((node1 == NULL) || (node1->type != LXB_DOM_NODE_TYPE_ELEMENT) ||
-		(0 <= (ptrdiff_t) node1->user)) {
+		!nl_node_order_known(node1)) {
 		/*
 		* Fallback for whatever case.
 		*/
@@ -278,7 +291,7 @@ xmlXPathCmpNodesExt(lxb_dom_node_t_ptr node1, lxb_dom_node_t_ptr node2) {
 		node2 = node2->parent;
 	    }
 	    if ((node2 == NULL) || (node2->type != LXB_DOM_NODE_TYPE_ELEMENT) ||
-		(0 <= (ptrdiff_t) node2->user))
+		!nl_node_order_known(node2))
 	    {
 		node2 = miscNode2;
 		precedence2 = 0;
@@ -351,12 +364,12 @@ xmlXPathCmpNodesExt(lxb_dom_node_t_ptr node1, lxb_dom_node_t_ptr node2) {
      */
     if ((node1->type == LXB_DOM_NODE_TYPE_ELEMENT) &&
 	(node2->type == LXB_DOM_NODE_TYPE_ELEMENT) &&
-	(0 > (ptrdiff_t) node1->user) &&
-	(0 > (ptrdiff_t) node2->user) &&
+	nl_node_order_known(node1) &&
+	nl_node_order_known(node2) &&
 	(node1->owner_document == node2->owner_document)) {
 
-	l1 = -((ptrdiff_t) node1->user);
-	l2 = -((ptrdiff_t) node2->user);
+	l1 = (uintptr_t) node1->user;
+	l2 = (uintptr_t) node2->user;
 	if (l1 < l2)
 	    return(1);
 	if (l1 > l2)
@@ -419,12 +432,12 @@ turtle_comparison:
      */
     if ((node1->type == LXB_DOM_NODE_TYPE_ELEMENT) &&
 	(node2->type == LXB_DOM_NODE_TYPE_ELEMENT) &&
-	(0 > (ptrdiff_t) node1->user) &&
-	(0 > (ptrdiff_t) node2->user) &&
+	nl_node_order_known(node1) &&
+	nl_node_order_known(node2) &&
 	(node1->owner_document == node2->owner_document)) {
 
-	l1 = -((ptrdiff_t) node1->user);
-	l2 = -((ptrdiff_t) node2->user);
+	l1 = (uintptr_t) node1->user;
+	l2 = (uintptr_t) node2->user;
 	if (l1 < l2)
 	    return(1);
 	if (l1 > l2)
@@ -3282,49 +3295,19 @@ xmlXPathFormatNumber(double number, char buffer[], int buffersize)
  * @doc:  an input document
  *
  * Call this routine to speed up XPath computation on static documents.
- * This stamps all the element nodes with the document order
- * Like for line information, the order is kept in the <del>element->content</del> node->user
- * field, the value stored is actually - the node number (starting at -1)
- * to be able to differentiate from line numbers.
+ * This stamps all the nodes with the document order keys shared with
+ * the css results, see nl_node_order_assign(). Node sets are sorted with
+ * them, and the document is renumbered when needed by
+ * nl_xmlXPathNodeSetSort() anyway.
  *
- * Returns the number of elements found in the document or -1 in case
+ * Returns the number of nodes found in the document or -1 in case
  *    of error.
  */
 long
 nl_xmlXPathOrderDocElems(lxb_dom_document_t_ptr doc) {
-    ptrdiff_t count = 0;
-    lxb_dom_node_t_ptr cur;
-
     if (doc == NULL)
 	return(-1);
-    cur = doc->node.first_child;
-    while (cur != NULL) {
-	if (cur->type == LXB_DOM_NODE_TYPE_ELEMENT) {
-	    cur->user = (void *) (-(++count));
-	    if (cur->first_child != NULL) {
-		cur = cur->first_child;
-		continue;
-	    }
-	}
-	if (cur->next != NULL) {
-	    cur = cur->next;
-	    continue;
-	}
-	do {
-	    cur = cur->parent;
-	    if (cur == NULL)
-		break;
-	    if (cur == (lxb_dom_node_t_ptr) doc) {
-		cur = NULL;
-		break;
-	    }
-	    if (cur->next != NULL) {
-		cur = cur->next;
-		break;
-	    }
-	} while (cur != NULL);
-    }
-    return(count);
+    return(nl_node_order_assign(doc));
 }
 
 /**
@@ -3392,13 +3375,13 @@ nl_xmlXPathCmpNodes(lxb_dom_node_t_ptr node1, lxb_dom_node_t_ptr node2) {
      */
     if ((node1->type == LXB_DOM_NODE_TYPE_ELEMENT) &&
 	(node2->type == LXB_DOM_NODE_TYPE_ELEMENT) &&
-	(0 > (ptrdiff_t) node1->user) &&
-	(0 > (ptrdiff_t) node2->user) &&
+	nl_node_order_known(node1) &&
+	nl_node_order_known(node2) &&
 	(node1->owner_document == node2->owner_document)) {
-	ptrdiff_t l1, l2;
+	uintptr_t l1, l2;
 
-	l1 = -((ptrdiff_t) node1->user);
-	l2 = -((ptrdiff_t) node2->user);
+	l1 = (uintptr_t) node1->user;
+	l2 = (uintptr_t) node2->user;
 	if (l1 < l2)
 	    return(1);
 	if (l1 > l2)
@@ -3455,13 +3438,13 @@ nl_xmlXPathCmpNodes(lxb_dom_node_t_ptr node1, lxb_dom_node_t_ptr node2) {
      */
     if ((node1->type == LXB_DOM_NODE_TYPE_ELEMENT) &&
 	(node2->type == LXB_DOM_NODE_TYPE_ELEMENT) &&
-	(0 > (ptrdiff_t) node1->user) &&
-	(0 > (ptrdiff_t) node2->user) &&
+	nl_node_order_known(node1) &&
+	nl_node_order_known(node2) &&
 	(node1->owner_document == node2->owner_document)) {
-	ptrdiff_t l1, l2;
+	uintptr_t l1, l2;
 
-	l1 = -((ptrdiff_t) node1->user);
-	l2 = -((ptrdiff_t) node2->user);
+	l1 = (uintptr_t) node1->user;
+	l2 = (uintptr_t) node2->user;
 	if (l1 < l2)
 	    return(1);
 	if (l1 > l2)
@@ -3518,6 +3501,7 @@ nl_xmlXPathNodeSetSort(xmlNodeSetPtr set) {
 	}
     }
 #else /* WITH_TIM_SORT */
+    nl_node_order_prepare(set->nodeTab, set->nodeNr);
     nl_xml_domnode_tim_sort(set->nodeTab, set->nodeNr);
 #endif /* WITH_TIM_SORT */
 }
@@ -11980,6 +11964,49 @@ xmlXPathIsPositionalPredicate(xmlXPathParserContextPtr ctxt,
     return(0);
 }
 
+/**
+ * xmlXPathNameTestId:
+ * @doc:  the document being searched
+ * @isAttr:  whether @name is an attribute name
+ * @name:  the name of a NODE_TEST_NAME step without prefix
+ *
+ * Resolve @name to the id lexbor interns for it in @doc, so that name
+ * tests can compare ids instead of strings.
+ *
+ * Returns the id, or 0 if @name is unknown to @doc or is not spelled
+ * exactly as the interned name (lexbor looks names up ignoring case).
+ */
+static uintptr_t
+xmlXPathNameTestId(lxb_dom_document_t *doc, int isAttr, const xmlChar *name)
+{
+    const lexbor_hash_entry_t *entry;
+    uintptr_t id;
+    size_t len = nl_xmlStrlen(name);
+
+    if (isAttr) {
+        const lxb_dom_attr_data_t *data;
+
+        data = lxb_dom_attr_data_by_local_name(doc->attrs, name, len);
+        if (data == NULL)
+            return(0);
+        entry = &data->entry;
+        id = data->attr_id;
+    } else {
+        const lxb_tag_data_t *data;
+
+        data = lxb_tag_data_by_name(doc->tags, name, len);
+        if (data == NULL)
+            return(0);
+        entry = &data->entry;
+        id = data->tag_id;
+    }
+
+    if ((entry->length != len) ||
+        (memcmp(lexbor_hash_entry_str(entry), name, len) != 0))
+        return(0);
+    return(id);
+}
+
 static int
 xmlXPathNodeCollectAndTest(xmlXPathParserContextPtr ctxt,
                            xmlXPathStepOpPtr op,
@@ -12047,6 +12074,8 @@ xmlXPathNodeCollectAndTest(xmlXPathParserContextPtr ctxt,
     xmlXPathNodeSetMergeFunction mergeAndClear;
     lxb_dom_node_t_ptr oldContextNode;
     xmlXPathContextPtr xpctxt = ctxt->context;
+    /* The lexbor id of the name tested, 0 if names are compared as strings */
+    uintptr_t nameId = 0;
 
 
     CHECK_TYPE0(XPATH_NODESET);
@@ -12062,6 +12091,13 @@ xmlXPathNodeCollectAndTest(xmlXPathParserContextPtr ctxt,
 	}
     }
     /*
+    * Setup name ids, unprefixed names are matched against the
+    * interned local names of nodes in the context document.
+    */
+    if ((test == NODE_TEST_NAME) && (prefix == NULL) && (name != NULL) &&
+        (xpctxt->doc != NULL) && (axis != AXIS_NAMESPACE))
+        nameId = xmlXPathNameTestId(xpctxt->doc, axis == AXIS_ATTRIBUTE, name);
+    /*
     * Setup axis.
     *
     * MAYBE FUTURE TODO: merging optimizations:
@@ -12384,7 +12420,13 @@ xmlXPathNodeCollectAndTest(xmlXPathParserContextPtr ctxt,
 		    }
                     switch (cur->type) {
                         case LXB_DOM_NODE_TYPE_ELEMENT:
-                            if (nl_xmlStrEqual(name, NODE_NAME(cur))) {
+                            if ((nameId != 0) &&
+                                (cur->owner_document == xpctxt->doc) &&
+                                (lxb_dom_interface_element(cur)->qualified_name == 0)) {
+                                if (cur->local_name == nameId) {
+                                    XP_TEST_HIT
+                                }
+                            } else if (nl_xmlStrEqual(name, NODE_NAME(cur))) {
                                 if (prefix == NULL) {
 				    XP_TEST_HIT
                                 } else {
@@ -12399,7 +12441,15 @@ xmlXPathNodeCollectAndTest(xmlXPathParserContextPtr ctxt,
                         case LXB_DOM_NODE_TYPE_ATTRIBUTE:{
                                 lxb_dom_attr_t_ptr attr = (lxb_dom_attr_t_ptr) cur;
 
-                                if (nl_xmlStrEqual(name, NODE_NAME(attr))) {
+                                if ((nameId != 0) &&
+                                    (cur->owner_document == xpctxt->doc) &&
+                                    (attr->qualified_name == 0)) {
+                                    if ((cur->local_name == nameId) &&
+                                        (attr->node.prefix == NULL))
+                                    {
+                                        XP_TEST_HIT
+                                    }
+                                } else if (nl_xmlStrEqual(name, NODE_NAME(attr))) {
                                     if (prefix == NULL) {
                                         if (attr->node.prefix == NULL)
 					{
@@ -21,22 +21,41 @@ rescue LoadError => e
   require 'nokolexbor/nokolexbor'
 end
 
+require 'etc'
+
 require 'nokolexbor/version'
 require 'nokolexbor/node'
 require 'nokolexbor/document'
+require 'nokolexbor/push_parser'
 require 'nokolexbor/node_set'
 require 'nokolexbor/document_fragment'
 require 'nokolexbor/xpath'
 require 'nokolexbor/xpath_context'
+require 'nokolexbor/extractor'
 require 'nokolexbor/builder'
 
 module Nokolexbor
   class << self
-    def parse(*args)
-      Document.parse(*args)
+    def parse(*args, **options, &block)
+      Document.parse(*args, **options, &block)
     end
 
     alias_method :HTML, :parse
+
+    # Parse many HTML documents in parallel.
+    #
+    # The documents are parsed on +threads+ threads which release the GVL
+    # while parsing, so that all cores are used by a single call.
+    #
+    # @param htmls [Array<String, #read>]
+    # @param threads [Integer] Number of threads to parse on, including the
+    #   calling one.
+    #
+    # @return [Array<Document>] The documents, in the order of +htmls+.
+    def parse_many(htmls, threads: Etc.nprocessors)
+      htmls = htmls.map { |html| html.respond_to?(:read) ? html.read : html }
+      Document.parse_many_native(htmls, threads)
+    end
   end
 end
 
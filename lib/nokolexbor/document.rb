@@ -147,18 +147,145 @@ module Nokolexbor
     #   The HTML to be parsed. It may be a String, or any object that
     #   responds to #read such as an IO, or StringIO.
     #
+    # IO objects are read and parsed in blocks of {PARSE_CHUNK_SIZE} bytes,
+    # without reading the whole input into a String first.
+    #
+    # The encoding of the input is determined like browsers do, see
+    # {.detect_encoding}. A String or IO tagged with an encoding other than
+    # binary is taken to be in that encoding, unless it starts with a byte
+    # order mark. Input in other encodings than UTF-8 is decoded while it is
+    # parsed.
+    #
+    # Parsing can stop early when only the beginning of a page is needed,
+    # the document is then truncated, with the elements left open closed
+    # like at the end of the input. The conditions are checked between
+    # chunks of growing size, so a little more than needed may be parsed.
+    #
+    # @param encoding [Encoding, String] The encoding declared by the
+    #   transport layer, e.g. the charset of a Content-Type header.
+    # @param stop_after [String, Selector] Stop once the first element
+    #   matching this CSS selector has been closed, e.g. "head".
+    # @param stop_when [String, Selector] Stop as soon as an element matching
+    #   this CSS selector has been opened, e.g. "body".
+    # @param max_bytes [Integer] Parse at most this many bytes.
+    # @param skip [Array<Symbol>] Kinds of nodes not to build at all, which
+    #   saves the time and memory spent on content that is never read:
+    #   * +:comments+ - comments.
+    #   * +:blank_text+ - text made of whitespace only, except inside
+    #     <pre> and <textarea>.
+    #   * +:script_content+ - the text inside <script> and <style>.
+    #
+    # @yieldparam doc [Document] When a block is given, the document is
+    #   yielded and released by {#release!} once the block returns, and the
+    #   value of the block is returned.
+    #
     # @return [Document]
-    def self.parse(string_or_io)
+    #
+    # @example Parse only the head of a page
+    #   doc = Nokolexbor::Document.parse(html, stop_after: 'head')
+    #   doc.title
+    #
+    # @example Free the document as soon as it is not needed anymore
+    #   title = Nokolexbor::Document.parse(html) { |doc| doc.title }
+    #
+    # @example Build only the elements and the text that matters
+    #   doc = Nokolexbor::Document.parse(html, skip: [:comments, :blank_text, :script_content])
+    def self.parse(string_or_io, encoding: nil, stop_after: nil, stop_when: nil, max_bytes: nil, skip: nil, &block)
+      if block
+        doc = parse(string_or_io, encoding: encoding, stop_after: stop_after, stop_when: stop_when, max_bytes: max_bytes, skip: skip)
+        begin
+          return yield(doc)
+        ensure
+          doc.release!
+        end
+      end
+
       html = string_or_io
       if string_or_io.respond_to?(:read)
+        if string_or_io.method(:read).arity != 0
+          # IO#read(length) returns bytes, the encoding of the IO is only a hint.
+          encoding ||= string_or_io.external_encoding if string_or_io.respond_to?(:external_encoding)
+          return parse_in_chunks(string_or_io, encoding, stop_after, stop_when, max_bytes, skip)
+        end
+
         html = string_or_io.read
       end
 
-      if html.respond_to?(:encoding) && html.encoding != Encoding::UTF_8
-        html = html.encode(Encoding::UTF_8, invalid: :replace, undef: :replace)
+      if stop_after || stop_when || max_bytes
+        encoding ||= html.encoding
+        parse_in_chunks(html, encoding, stop_after, stop_when, max_bytes, skip)
+      else
+        parse_native(html, encoding, skip_flags(skip))
+      end
+    end
+
+    # Size of the blocks an IO is read in by {.parse}.
+    PARSE_CHUNK_SIZE = 64 * 1024
+
+    # Size of the first chunk parsed when parsing may stop early, the
+    # following chunks double in size.
+    EARLY_STOP_CHUNK_SIZE = 4 * 1024
+
+    def self.parse_in_chunks(source, encoding, stop_after, stop_when, max_bytes, skip)
+      parser = PushParser.new(encoding: encoding, skip: skip)
+      doc = parser.document
+      offset = 0
+      early_stop = stop_after || stop_when
+      chunk_size = early_stop ? EARLY_STOP_CHUNK_SIZE : PARSE_CHUNK_SIZE
+      loop do
+        length = max_bytes ? [chunk_size, max_bytes - offset].min : chunk_size
+        break if length <= 0
+
+        chunk = source.is_a?(String) ? source.byteslice(offset, length) : source.read(length)
+        break if chunk.nil? || chunk.empty?
+
+        parser << chunk
+        offset += chunk.bytesize
+        break if stop_when && doc.at_css(stop_when)
+        break if stop_after && (node = doc.at_css(stop_after)) && !doc.open_elements.include?(node)
+
+        chunk_size *= 2 if early_stop
+      end
+      parser.finish
+    end
+    private_class_method :parse_in_chunks
+
+    SKIP_FLAGS = {
+      comments: SKIP_COMMENTS,
+      blank_text: SKIP_BLANK_TEXT,
+      script_content: SKIP_SCRIPT_CONTENT,
+    }.freeze # :nodoc:
+
+    def self.skip_flags(skip) # :nodoc:
+      Array(skip).inject(0) do |flags, kind|
+        flags | SKIP_FLAGS.fetch(kind) { raise ArgumentError, "Unknown kind of nodes to skip: #{kind.inspect}" }
       end
+    end
 
-      parse_native(html)
+    # Replace the content of this document by parsing +string_or_io+, the
+    # encoding being determined like for {.parse}.
+    #
+    # The memory of the previous content is recycled rather than freed, which
+    # spares allocations when many pages are parsed one after another. Every
+    # {Node} and {NodeSet} obtained from this document before is invalidated,
+    # using them raises a RuntimeError.
+    #
+    # @param string_or_io [String, #read]
+    # @param encoding [Encoding, String] The encoding declared by the
+    #   transport layer, e.g. the charset of a Content-Type header.
+    # @param skip [Array<Symbol>] Kinds of nodes not to build, see {.parse}.
+    #
+    # @return [Document] +self+
+    #
+    # @example Reuse one document per worker
+    #   doc = Nokolexbor::Document.new
+    #   pages.each do |html|
+    #     doc.reparse(html)
+    #     puts doc.title
+    #   end
+    def reparse(string_or_io, encoding: nil, skip: nil)
+      html = string_or_io.respond_to?(:read) ? string_or_io.read : string_or_io
+      reparse_native(html, encoding, Document.skip_flags(skip))
     end
 
     private
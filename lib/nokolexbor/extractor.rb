@@ -0,0 +1,66 @@
+# frozen_string_literal: true
+
+module Nokolexbor
+  # A schema compiled once to extract values from many nodes with
+  # {Node#extract} and {NodeSet#extract}.
+  #
+  # Each field of the schema maps a key to a CSS selector, searched from the
+  # node values are extracted from:
+  # * <tt>"h3"</tt> - the text of the first match, or nil.
+  # * <tt>"a@href"</tt> - the +href+ attribute of the first match, or nil.
+  # * <tt>"@data-id"</tt> - the +data-id+ attribute of the node itself.
+  # * <tt>["li"]</tt> - the values of all the matches, as an Array.
+  #
+  # Values are extracted natively and returned as Strings, without creating
+  # a {Node} for any of the matches.
+  #
+  # An Extractor is immutable and can be shared between threads.
+  #
+  # @example
+  #   RESULT = Nokolexbor::Extractor.new(title: 'h3', url: 'a@href', snippet: '.VwiC3b')
+  #   doc.css('div.g').extract(RESULT)
+  #   # => [{title: "...", url: "https://...", snippet: "..."}, ...]
+  class Extractor
+    # @return [Hash] The schema this extractor was compiled from.
+    attr_reader :schema
+
+    # @param schema [Hash{Object => String, Array<String>}]
+    def initialize(schema)
+      raise ArgumentError, "Expected a Hash, got #{schema.class}" unless schema.is_a?(Hash)
+
+      @schema = schema.dup.freeze
+      @fields = schema.map { |key, spec| compile_field(key, spec) }.freeze
+      freeze
+    end
+
+    # @return [Extractor] +schema+ itself if already compiled, or a new
+    #   Extractor compiled from it.
+    def self.for(schema)
+      schema.is_a?(Extractor) ? schema : new(schema)
+    end
+
+    # Fields as expected by the native implementation of {Node#extract}.
+    attr_reader :fields # :nodoc:
+
+    private
+
+    # The attribute follows the last "@", unless that "@" is part of the
+    # selector itself, e.g. in a quoted attribute value.
+    ATTRIBUTE_SUFFIX = /\A(.*?)@([^\s@"'\])]+)\z/m # :nodoc:
+
+    def compile_field(key, spec)
+      all = spec.is_a?(Array)
+      if all
+        raise ArgumentError, "Expected a single selector for #{key.inspect}, got #{spec.inspect}" unless spec.size == 1
+
+        spec = spec.first
+      end
+      raise ArgumentError, "Expected a String for #{key.inspect}, got #{spec.class}" unless spec.is_a?(String)
+
+      selector, attribute = ATTRIBUTE_SUFFIX.match(spec)&.captures || [spec, nil]
+      selector = selector.strip
+      selector = selector.empty? ? nil : Selector.new(selector)
+      [key, selector, attribute&.freeze, all].freeze
+    end
+  end
+end
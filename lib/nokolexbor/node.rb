@@ -17,9 +17,6 @@ module Nokolexbor
     DOCUMENT_FRAG_NODE = 11
     NOTATION_NODE = 12
 
-    # @return [Document] The associated {Document} of this node
-    attr_reader :document
-
     LOOKS_LIKE_XPATH = %r{^(\./|/|\.\.|\.$)}
 
     # @return true if this is a {Comment}
@@ -71,8 +68,8 @@ module Nokolexbor
     #
     # @return [NodeSet] A set of matched ancestor nodes
     def ancestors(selector = nil)
-      return NodeSet.new(@document) unless respond_to?(:parent)
-      return NodeSet.new(@document) unless parent
+      return NodeSet.new(document) unless respond_to?(:parent)
+      return NodeSet.new(document) unless parent
 
       parents = [parent]
 
@@ -82,12 +79,12 @@ module Nokolexbor
         parents << ctx_parent
       end
 
-      return NodeSet.new(@document, parents) unless selector
+      return NodeSet.new(document, parents) unless selector
 
       root = parents.last
       search_results = root.search(selector)
 
-      NodeSet.new(@document, parents.find_all do |parent|
+      NodeSet.new(document, parents.find_all do |parent|
         search_results.include?(parent)
       end)
     end
@@ -235,7 +232,7 @@ module Nokolexbor
       yield(self)
     end
 
-    # @param selector [String] The selector to match
+    # @param selector [String, Selector] The selector to match
     #
     # @return true if this Node matches +selector+
     def matches?(selector)
@@ -326,13 +323,17 @@ module Nokolexbor
     #   node.css('title')
     #   node.css('body h1.bold')
     #   node.css('div + p.green', 'div#one')
+    #   node.css(Nokolexbor::Selector.new('body h1.bold'))
+    #
+    # @param args [String, Selector] One or more selectors, or a single
+    #   pre-compiled {Selector}.
     #
     # @return [NodeSet] The matched set of Nodes.
     #
     # @see #xpath
     # @see #nokogiri_css
     def css(*args)
-      css_impl(args.join(', '))
+      css_impl(css_selector_from_args(args))
     end
 
     # Like {#css}, but returns the first match.
@@ -344,13 +345,83 @@ module Nokolexbor
     # @see #css
     # @see #nokogiri_at_css
     def at_css(*args)
-      at_css_impl(args.join(', '))
+      at_css_impl(css_selector_from_args(args))
+    end
+
+    # Count the matches of {#css}, without building the set of nodes. Nodes
+    # matched by several selectors of a list are counted once.
+    #
+    # @example
+    #   doc.css_count('div.result') # same as doc.css('div.result').size
+    #
+    # @return [Integer]
+    def css_count(*args)
+      css_count_impl(css_selector_from_args(args))
+    end
+
+    # Whether {#css} would match anything, the search stops at the first
+    # match.
+    #
+    # @example
+    #   doc.css_any?('div.captcha') # same as !doc.at_css('div.captcha').nil?
+    #
+    # @return [Boolean]
+    def css_any?(*args)
+      css_any_impl(css_selector_from_args(args))
+    end
+
+    # Like {#css}, but returns the text of each match rather than the nodes,
+    # which are never wrapped in {Node} objects.
+    #
+    # @example
+    #   doc.css_text('li') # same as doc.css('li').map(&:text)
+    #
+    # @return [Array<String>]
+    def css_text(*args)
+      css_values_impl(css_selector_from_args(args), nil)
+    end
+
+    # Like {#css}, but returns the value of the attribute +name+ of each
+    # match rather than the nodes, which are never wrapped in {Node} objects.
+    #
+    # @example
+    #   doc.css_attr('a', 'href') # same as doc.css('a').map { |a| a['href'] }
+    #
+    # @param selector [String, Selector]
+    # @param name [String] The name of the attribute.
+    #
+    # @return [Array<String, nil>] nil for the matches without the attribute.
+    def css_attr(selector, name)
+      css_values_impl(selector, name)
+    end
+
+    # Like {#at_css}, but returns the text of the first match.
+    #
+    # @return [String, nil] The text of the first match, or nil if none.
+    def at_css_text(*args)
+      at_css_text_impl(css_selector_from_args(args))
+    end
+
+    # Extract the values described by +schema+ from the subtree of this node.
+    #
+    # @example
+    #   result.extract(title: 'h3', url: 'a@href', tags: ['.tag'])
+    #   # => {title: "Title", url: "https://example.com", tags: ["a", "b"]}
+    #
+    # @param schema [Hash, Extractor] The fields to extract, see {Extractor}.
+    #   Pass an {Extractor} to compile a schema used repeatedly only once.
+    #
+    # @return [Hash] The value of each field of +schema+.
+    def extract(schema)
+      extract_impl(Extractor.for(schema).fields)
     end
 
     # Search this object for CSS +rules+. +rules+ must be one or more CSS
     # selectors. It supports a mixed syntax of CSS selectors and XPath.
     #
     # This method uses libxml2 as the selector engine. It works the same way as {Nokogiri::Node#css}.
+    # Selectors are translated to XPath natively by {CSS.xpath_for}, Nokogiri is only
+    # loaded for the syntax it alone understands, such as XPath extensions.
     #
     # @return [NodeSet] The matched set of Nodes.
     #
@@ -380,6 +451,7 @@ module Nokolexbor
     #
     # @example
     #   node.xpath('.//title')
+    #   node.xpath(Nokolexbor::XPath.compile('.//title'))
     #
     # @return [NodeSet] The matched set of Nodes.
     def xpath(*args)
@@ -672,6 +744,10 @@ module Nokolexbor
       end
     end
 
+    def css_selector_from_args(args)
+      args.size == 1 && Selector === args.first ? args.first : args.join(', ')
+    end
+
     def nokogiri_css_internal(node, rules, handler, ns)
       xpath_internal(node, css_rules_to_xpath(rules, ns), handler, ns, nil)
     end
@@ -684,7 +760,7 @@ module Nokolexbor
         return xpath_impl(node, paths.first, handler, ns, binds)
       end
 
-      NodeSet.new(@document) do |combined|
+      NodeSet.new(document) do |combined|
         paths.each do |path|
           xpath_impl(node, path, handler, ns, binds).each { |set| combined << set }
         end
@@ -692,6 +768,8 @@ module Nokolexbor
     end
 
     def xpath_impl(node, path, handler, ns, binds)
+      return XPathContext.evaluate_on(node, path) if ns.empty? && binds.nil?
+
       ctx = XPathContext.new(node)
       ctx.register_namespaces(ns)
       # path = path.gsub(/xmlns:/, " :") unless Nokogiri.uses_libxml?
@@ -716,6 +794,13 @@ module Nokolexbor
     end
 
     def xpath_query_from_css_rule(rule, ns)
+      if ns.empty?
+        xpaths = self.class::IMPLIED_XPATH_CONTEXTS.map do |implied_xpath_context|
+          CSS.xpath_for(rule.to_s, implied_xpath_context)
+        end
+        return xpaths.join(" | ") if xpaths.all?
+      end
+
       ensure_nokogiri
 
       unless defined?(Gem)
@@ -753,7 +838,7 @@ module Nokolexbor
 
     def extract_params(params)
       handler = params.find do |param|
-        ![Hash, String, Symbol].include?(param.class)
+        ![Hash, String, Symbol, XPath::Expression].include?(param.class)
       end
       params -= [handler] if handler
 
@@ -281,6 +281,20 @@ module Nokolexbor
       end
     end
 
+    # Extract the values described by +schema+ from each node, the schema
+    # being compiled only once.
+    #
+    # @example
+    #   doc.css('div.g').extract(title: 'h3', url: 'a@href')
+    #
+    # @param schema [Hash, Extractor] see {Node#extract}
+    #
+    # @return [Array<Hash>]
+    def extract(schema)
+      fields = Extractor.for(schema).fields
+      map { |node| node.extract_impl(fields) }
+    end
+
     def inspect
       "[#{map(&:inspect).join(', ')}]"
     end
@@ -0,0 +1,104 @@
+# frozen_string_literal: true
+
+module Nokolexbor
+  # Parse HTML incrementally, as its bytes arrive.
+  #
+  # The {#document} can be searched at any point, it then holds the tree
+  # built from the HTML fed so far, with elements that are not closed yet.
+  # Until {#finish} is called, nodes may be moved with {Node#remove} but
+  # not destroyed, and no fragments may be parsed into the document.
+  #
+  # @example Extract metadata before the whole page has been downloaded
+  #   parser = Nokolexbor::PushParser.new
+  #   response.read_body do |chunk|
+  #     parser << chunk
+  #     break if (title = parser.document.at_css('head title'))
+  #   end
+  class PushParser
+    # @return [Document] The document being built.
+    attr_reader :document
+
+    # @param encoding [Encoding, String] The encoding declared by the
+    #   transport layer. The encoding is determined from the first chunk like
+    #   in {Document.parse}, a chunk tagged with an encoding other than
+    #   binary is taken to be in that encoding.
+    # @param skip [Array<Symbol>] Kinds of nodes not to build, see
+    #   {Document.parse}.
+    def initialize(encoding: nil, skip: nil)
+      @document = Document.parse_chunk_begin(Document.skip_flags(skip))
+      @encoding = encoding
+      @converter = nil
+      @started = false
+    end
+
+    # Parse the next chunk of HTML. A chunk may end anywhere, even in the
+    # middle of a tag or of a multibyte character.
+    #
+    # @param chunk [String]
+    # @param last_chunk [Boolean] whether to {#finish} after this chunk.
+    #
+    # @return [PushParser] +self+
+    def write(chunk, last_chunk = false)
+      unless @started
+        chunk = start(chunk, last_chunk)
+        return self unless chunk
+      end
+      chunk = @converter.convert(chunk) if @converter
+      @document.parse_chunk(chunk)
+      finish if last_chunk
+      self
+    end
+
+    alias_method :<<, :write
+
+    # Finish parsing, closing all elements left open.
+    #
+    # @return [Document] The complete document.
+    def finish
+      write(start("".b, true)) unless @started
+      @document.parse_chunk(@converter.finish) if @converter
+      @document.parse_chunk_end
+    end
+
+    # @return [Boolean] true if {#finish} has been called.
+    def finished?
+      !@document.parsing?
+    end
+
+    private
+
+    # Byte order marks, which take precedence over any other encoding
+    # information and aren't part of the content.
+    BYTE_ORDER_MARKS = {
+      Encoding::UTF_8 => "\xEF\xBB\xBF".b,
+      Encoding::UTF_16BE => "\xFE\xFF".b,
+      Encoding::UTF_16LE => "\xFF\xFE".b,
+    }.freeze # :nodoc:
+
+    # Determine the encoding from the first chunk. Without a hint, chunks are
+    # held back until the first 1024 bytes, where <meta charset> is looked
+    # for, have arrived.
+    #
+    # @return [String, nil] The chunks held back, or nil to wait for more.
+    def start(chunk, last_chunk = false)
+      hint = @encoding || (chunk.encoding unless chunk.encoding == Encoding::BINARY || chunk.encoding == Encoding::US_ASCII)
+      chunk = @pending + chunk.b if @pending
+      @pending = nil
+      unless hint || last_chunk
+        @pending = chunk.b
+        return if @pending.bytesize < 1024
+
+        chunk = @pending
+        @pending = nil
+      end
+      @started = true
+
+      encoding = Document.detect_encoding(chunk, hint)
+      bom = BYTE_ORDER_MARKS[encoding]
+      chunk = chunk.byteslice(bom.bytesize..) if bom && chunk.b.start_with?(bom)
+      # The converter keeps a character split between chunks until the next one.
+      @converter = Encoding::Converter.new(encoding, Encoding::UTF_8, invalid: :replace, undef: :replace) if encoding != Encoding::UTF_8
+      chunk
+    end
+  end
+end
@@ -0,0 +1,46 @@
+require 'spec_helper'
+
+describe Nokolexbor::CSS do
+  describe 'xpath_for' do
+    it 'translates compound selectors' do
+      _(Nokolexbor::CSS.xpath_for('div')).must_equal './/div'
+      _(Nokolexbor::CSS.xpath_for('*')).must_equal './/*'
+      _(Nokolexbor::CSS.xpath_for('div#a.b')).must_equal ".//div[@id='a' and nokogiri-builtin:css-class(@class,'b')]"
+      _(Nokolexbor::CSS.xpath_for('[href^="http"]')).must_equal ".//*[starts-with(@href,'http')]"
+      _(Nokolexbor::CSS.xpath_for(%q{[title="it's"]})).must_equal %q{.//*[@title="it's"]}
+    end
+
+    it 'translates combinators and selector lists' do
+      _(Nokolexbor::CSS.xpath_for('ul > li a')).must_equal './/ul/li//a'
+      _(Nokolexbor::CSS.xpath_for('h1 + p')).must_equal './/h1/following-sibling::*[1]/self::p'
+      _(Nokolexbor::CSS.xpath_for('h1 ~ p, a')).must_equal './/h1/following-sibling::p | .//a'
+      _(Nokolexbor::CSS.xpath_for('> p')).must_equal './p'
+      _(Nokolexbor::CSS.xpath_for('div', '//')).must_equal '//div'
+      _(Nokolexbor::CSS.xpath_for('div', 'self::')).must_equal 'self::div'
+    end
+
+    it 'returns nil for syntax it does not translate' do
+      _(Nokolexbor::CSS.xpath_for('div /text()')).must_be_nil
+      _(Nokolexbor::CSS.xpath_for('div > ::text')).must_be_nil
+      _(Nokolexbor::CSS.xpath_for('[a="b" i]')).must_be_nil
+      _(Nokolexbor::CSS.xpath_for('> p', '//')).must_be_nil
+    end
+
+    it 'matches the same nodes as css' do
+      doc = Nokolexbor::HTML <<-HTML
+        <ul id="list">
+          <li class="x y">1</li><li lang="en-US">2</li><li title='a"b'>3</li>
+          <li><a href="https://example.com/a.pdf">4</a></li><li></li><p>5</p>
+        </ul>
+      HTML
+      [
+        'li', 'li.y', '#list > li', 'li:first-child', 'li:last-of-type', 'li:nth-child(2n+1)',
+        'li:nth-child(-n+2)', 'li:nth-last-child(2)', 'li:nth-of-type(odd)', 'li:only-child',
+        'li:empty', 'li:not(.x, [lang])', 'li:has(> a)', 'ul:has(a[href$=".pdf"])', '[lang|=en]',
+        '[class~=x]', '[href*=example]', 'li + li', 'li ~ p', ':root', '[title=\'a"b\']',
+      ].each do |selector|
+        _(doc.nokogiri_css(selector).to_a).must_equal doc.css(selector).to_a, selector
+      end
+    end
+  end
+end
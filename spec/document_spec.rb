@@ -1,4 +1,6 @@
 require 'spec_helper'
+require 'tempfile'
+require 'objspace'
 
 describe Nokolexbor::Document do
   before do
@@ -79,6 +81,77 @@ describe Nokolexbor::Document do
       _(doc.to_html).must_equal '<html><head></head><body><div>Hello</div></body></html>'
     end
 
+    it 'works with io read in chunks' do
+      reader = Class.new do
+        def initialize(html)
+          @io = StringIO.new(html)
+        end
+
+        def read(length)
+          @io.read([length, 5].min)
+        end
+      end
+      html = '<body><!--comment--><div class="a">123</div><p id="long-attribute-value">世界！</p></body>'
+      doc = Nokolexbor::Document.parse(reader.new(html))
+      expected = Nokolexbor::Document.parse(html)
+      _(doc.to_html).must_equal expected.to_html
+      _(doc.css('*, ::text, [class], [id]').map(&:source_location)).must_equal expected.css('*, ::text, [class], [id]').map(&:source_location)
+      _(doc.at_css('p').attribute('id').source_location).must_equal html.b.index("id=")
+    end
+
+    describe 'from a file' do
+      it 'parses the file' do
+        Tempfile.create(['nokolexbor', '.html']) do |file|
+          html = '<div title="你好">' + ('<p>x</p>' * 10_000) + '</div>'
+          file.write(html)
+          file.close
+          doc = Nokolexbor::Document.parse_file(file.path)
+          _(doc.at_css('div')['title']).must_equal '你好'
+          _(doc.css('p').size).must_equal 10_000
+          _(doc.css('p').last.source_location).must_equal html.bytesize - 'p>x</p></div>'.bytesize
+        end
+      end
+
+      it 'parses an empty file' do
+        Tempfile.create('nokolexbor') do |file|
+          _(Nokolexbor::Document.parse_file(file.path).to_html).must_equal '<html><head></head><body></body></html>'
+        end
+      end
+
+      it 'raises if the file does not exist' do
+        _ { Nokolexbor::Document.parse_file('/nonexistent/nokolexbor.html') }.must_raise Errno::ENOENT
+      end
+    end
+
+    describe 'stopping early' do
+      before do
+        @html = "<html><head><title>T</title></head><body>#{'<div>x</div>' * 2000}<p class='target'>y</p>#{'<div>x</div>' * 2000}</body></html>"
+      end
+
+      it 'stops after an element is closed' do
+        doc = Nokolexbor::Document.parse(@html, stop_after: 'head')
+        _(doc.title).must_equal 'T'
+        _(doc.css('div').size).must_be :<, 2000
+        _(doc.at_css('html > body')).wont_be_nil
+      end
+
+      it 'stops when a selector matches' do
+        doc = Nokolexbor::HTML(StringIO.new(@html), stop_when: 'p.target')
+        _(doc.at_css('p.target')).wont_be_nil
+        _(doc.css('div').size).must_be :<, 4000
+      end
+
+      it 'stops after max_bytes' do
+        doc = Nokolexbor::Document.parse('<div>Hello</div><p>World</p>', max_bytes: 16)
+        _(doc.to_html).must_equal '<html><head></head><body><div>Hello</div></body></html>'
+      end
+
+      it 'parses everything when the condition is never met' do
+        doc = Nokolexbor::Document.parse(@html, stop_after: 'footer')
+        _(doc.css('div').size).must_equal 4000
+      end
+    end
+
     describe 'with non-utf-8 encoding' do
       before do
         @html_utf8 = '<html><head></head><body><div title="你好">世界！</div></body></html>'
@@ -123,6 +196,68 @@ describe Nokolexbor::Document do
       end
     end
 
+    describe 'detecting the encoding' do
+      before do
+        @html = '<html><head><meta charset="gbk"></head><body><div>世界</div></body></html>'
+        @bytes = @html.encode(Encoding::GBK).b
+      end
+
+      it 'uses <meta charset> of binary strings' do
+        _(Nokolexbor::Document.detect_encoding(@bytes)).must_equal Encoding::GBK
+        _(Nokolexbor::Document.parse(@bytes).at_css('div').text).must_equal '世界'
+        _(Nokolexbor::Document.parse(StringIO.new(@bytes)).at_css('div').text).must_equal '世界'
+        _(Nokolexbor::Document.parse(@bytes, stop_after: 'div').at_css('div').text).must_equal '世界'
+      end
+
+      it 'uses <meta http-equiv>' do
+        html = '<meta http-equiv="Content-Type" content="text/html; charset=Shift_JIS">'.b
+        _(Nokolexbor::Document.detect_encoding(html)).must_equal Encoding::Windows_31J
+      end
+
+      it 'prefers the hint over <meta>' do
+        html = '<meta charset="iso-8859-1"><div>世界</div>'.encode(Encoding::GBK).b
+        _(Nokolexbor::Document.detect_encoding(html, 'gbk')).must_equal Encoding::GBK
+        _(Nokolexbor::Document.detect_encoding(html)).must_equal Encoding::Windows_1252
+        _(Nokolexbor::Document.parse(html, encoding: 'gbk').at_css('div').text).must_equal '世界'
+      end
+
+      it 'prefers a byte order mark over everything' do
+        html = "\uFEFF<div>été</div>".encode(Encoding::UTF_16LE)
+        _(Nokolexbor::Document.detect_encoding(html.b, Encoding::GBK)).must_equal Encoding::UTF_16LE
+        _(Nokolexbor::Document.parse(html.b).at_css('body').inner_html).must_equal '<div>été</div>'
+        _(Nokolexbor::Document.parse("\uFEFF<div>été</div>".b).at_css('body').inner_html).must_equal '<div>été</div>'
+        _(Nokolexbor.parse_many([html.b], threads: 1).first.at_css('body').inner_html).must_equal '<div>été</div>'
+        parser = Nokolexbor::PushParser.new
+        html.b.each_char { |byte| parser << byte }
+        _(parser.finish.at_css('body').inner_html).must_equal '<div>été</div>'
+      end
+
+      it 'defaults to utf-8' do
+        _(Nokolexbor::Document.detect_encoding('<div>été</div>'.b)).must_equal Encoding::UTF_8
+      end
+
+      it 'decodes large documents across chunks' do
+        items = 20_000.times.map { |i| "<li title='#{'世' * (i % 7)}'>#{i}界</li>" }.join
+        utf8 = "<meta charset='gbk'><ul>#{items}</ul>"
+        bytes = utf8.encode(Encoding::GBK).b
+        _(bytes.bytesize).must_be :>, 4 * 64 * 1024
+        expected = Nokolexbor::Document.parse(utf8)
+        [Nokolexbor::Document.parse(bytes), Nokolexbor.parse_many([bytes, bytes], threads: 2).last].each do |doc|
+          _(doc.css('li').size).must_equal 20_000
+          li = doc.css('li')[12_345]
+          _(li.text).must_equal '12345界'
+          _(li['title']).must_equal '世' * (12_345 % 7)
+          _(li.source_location).must_equal expected.css('li')[12_345].source_location
+        end
+      end
+
+      it 'decodes chunks split in the middle of a character' do
+        parser = Nokolexbor::PushParser.new
+        @bytes.chars.each { |byte| parser << byte }
+        _(parser.finish.at_css('div').text).must_equal '世界'
+      end
+    end
+
     describe 'with invalid bytes' do
       it 'replaces invalid characters with �' do
         html = +"<div>\xF0</div>"
@@ -279,4 +414,242 @@ describe Nokolexbor::Document do
       _(parent).must_be_instance_of Nokolexbor::Document
     end
   end
-end
\ No newline at end of file
+
+  describe 'css_cache' do
+    before do
+      @doc = Nokolexbor::HTML('<div class="a"><span>1</span></div><div class="b"><span>2</span></div>')
+      @doc.css_cache = true
+    end
+
+    it 'is disabled by default' do
+      _(Nokolexbor::HTML('').css_cache?).must_equal false
+      _(@doc.css_cache?).must_equal true
+    end
+
+    it 'returns the same results for repeated queries' do
+      3.times do
+        _(@doc.css('span').map(&:text)).must_equal ['1', '2']
+        _(@doc.at_css('div.b > span').text).must_equal '2'
+        _(@doc.at_css('section')).must_be_nil
+      end
+    end
+
+    it 'returns independent NodeSets' do
+      @doc.css('span').pop
+      _(@doc.css('span').size).must_equal 2
+    end
+
+    it 'is keyed by context node' do
+      _(@doc.at_css('div.a').css('span').text).must_equal '1'
+      _(@doc.at_css('div.b').css('span').text).must_equal '2'
+    end
+
+    it 'is invalidated by mutations' do
+      _(@doc.css('span').size).must_equal 2
+      @doc.at_css('div.a').add_child('<span>3</span>')
+      _(@doc.css('span').size).must_equal 3
+      @doc.at_css('span').remove
+      _(@doc.css('span').size).must_equal 2
+      _(@doc.at_css('div.c')).must_be_nil
+      @doc.at_css('div.a')['class'] = 'c'
+      _(@doc.at_css('div.c')).wont_be_nil
+      @doc.at_css('div.c').content = 'text'
+      _(@doc.css('div.c span').size).must_equal 0
+    end
+
+    it 'accepts selectors larger than the stack' do
+      selector = 'span' + ' ' * (16 * 1024 * 1024)
+      2.times { _(@doc.css(selector).size).must_equal 2 }
+    end
+
+    it 'can be disabled' do
+      @doc.css('span')
+      @doc.css_cache = false
+      _(@doc.css_cache?).must_equal false
+      _(@doc.css('span').size).must_equal 2
+    end
+  end
+
+  describe 'reparse' do
+    it 'replaces the content' do
+      doc = Nokolexbor::HTML('<title>first</title><div>1</div>')
+      _(doc.reparse('<title>second</title><span>2</span>')).must_be_same_as doc
+      _(doc.title).must_equal 'second'
+      _(doc.at_css('div')).must_be_nil
+      _(doc.at_css('span').text).must_equal '2'
+    end
+
+    it 'can be repeated' do
+      doc = Nokolexbor::Document.new
+      100.times do |i|
+        doc.reparse("<ul>#{'<li>x</li>' * i}</ul>")
+        _(doc.css('li').size).must_equal i
+      end
+    end
+
+    it 'detects the encoding' do
+      doc = Nokolexbor::HTML('')
+      doc.reparse('<meta charset="Shift_JIS"><p>'.b + "\x82\xa0".b)
+      _(doc.at_css('p').text).must_equal 'あ'
+    end
+
+    it 'invalidates the old nodes' do
+      doc = Nokolexbor::HTML('<div><span>1</span></div>')
+      div = doc.at_css('div')
+      spans = doc.css('span')
+      doc.reparse('<div><span>2</span></div>')
+      _ { div.name }.must_raise RuntimeError
+      _ { spans.first }.must_raise RuntimeError
+      _(doc.at_css('div span').text).must_equal '2'
+      _(doc.at_css('div')).wont_be_same_as div
+    end
+
+    it 'invalidates the css cache' do
+      doc = Nokolexbor::HTML('<div>1</div>')
+      doc.css_cache = true
+      _(doc.css('div').size).must_equal 1
+      doc.reparse('<div>1</div><div>2</div>')
+      _(doc.css('div').size).must_equal 2
+    end
+
+    it 'keeps the document from other threads until done' do
+      doc = Nokolexbor::HTML('<ul></ul>')
+      html = "<ul>#{'<li>x</li>' * 50_000}</ul>"
+      reparsing = Thread.new { 5.times { doc.reparse(html) } }
+      while reparsing.alive?
+        begin
+          _([0, 50_000]).must_include doc.css('li').size
+        rescue RuntimeError => e
+          _(e.message).must_equal 'Document is being reparsed'
+        end
+      end
+      reparsing.join
+      _(doc.css('li').size).must_equal 50_000
+    end
+
+    it 'is not allowed while parsing in chunks' do
+      parser = Nokolexbor::PushParser.new
+      parser << '<div>'
+      _ { parser.document.reparse('<p></p>') }.must_raise RuntimeError
+    end
+  end
+
+  it 'reports its native memory size' do
+    small = ObjectSpace.memsize_of(Nokolexbor::HTML('<div></div>'))
+    large = ObjectSpace.memsize_of(Nokolexbor::HTML('<div class="a">text</div>' * 10_000))
+    _(small).must_be :>, 1000
+    _(large).must_be :>, small + 250_000
+  end
+
+  describe 'release!' do
+    it 'frees the document' do
+      doc = Nokolexbor::HTML('<title>a</title><div><span>1</span></div>')
+      div = doc.at_css('div')
+      spans = doc.css('span')
+      _(doc.released?).must_equal false
+      _(doc.release!).must_be_nil
+      _(doc.released?).must_equal true
+      _ { doc.title }.must_raise RuntimeError
+      _ { doc.css('div') }.must_raise RuntimeError
+      _ { div.inner_html }.must_raise RuntimeError
+      _ { spans.first }.must_raise RuntimeError
+      _ { doc.reparse('<div></div>') }.must_raise RuntimeError
+    end
+
+    it 'can be called twice' do
+      doc = Nokolexbor::HTML('<div></div>')
+      doc.release!
+      _(doc.release!).must_be_nil
+    end
+
+    it 'stops a parse in chunks' do
+      parser = Nokolexbor::PushParser.new
+      parser << '<div>'
+      parser.document.release!
+      _(parser.finished?).must_equal true
+    end
+
+    it 'is called after the block given to parse' do
+      doc = nil
+      title = Nokolexbor.parse('<title>a</title>') do |d|
+        doc = d
+        d.title
+      end
+      _(title).must_equal 'a'
+      _(doc.released?).must_equal true
+    end
+
+    it 'is called when the block raises' do
+      doc = nil
+      _ { Nokolexbor::Document.parse('<div></div>') { |d| doc = d; raise ArgumentError } }.must_raise ArgumentError
+      _(doc.released?).must_equal true
+    end
+  end
+
+  describe 'skipping nodes' do
+    before do
+      @html = <<-HTML
+        <html>
+          <head><style>p { color: red }</style><!-- head --></head>
+          <body>
+            <script>var a = "<p>";</script>
+            <div> <span>a</span> <!-- body --> <span>b</span> </div>
+            <pre> </pre>
+          </body>
+        </html>
+      HTML
+    end
+
+    it 'builds all nodes by default' do
+      doc = Nokolexbor::HTML(@html)
+      _(doc.xpath('//comment()').size).must_equal 2
+      _(doc.at_css('script').text).must_equal 'var a = "<p>";'
+      _(doc.at_css('div').children.size).must_equal 7
+    end
+
+    it 'skips comments' do
+      doc = Nokolexbor::HTML(@html, skip: [:comments])
+      _(doc.xpath('//comment()').size).must_equal 0
+      # The whitespace around the comment is merged into one text node
+      _(doc.at_css('div').children.size).must_equal 5
+    end
+
+    it 'skips blank text' do
+      doc = Nokolexbor::HTML(@html, skip: :blank_text)
+      _(doc.at_css('div').children.map(&:name)).must_equal ['span', '#comment', 'span']
+      _(doc.at_css('body').children.map(&:name)).must_equal ['script', 'div', 'pre']
+      _(doc.at_css('pre').inner_html).must_equal ' '
+      _(doc.at_css('div').text).must_equal 'ab'
+    end
+
+    it 'keeps blank text nested inside of preformatted elements' do
+      doc = Nokolexbor::HTML('<pre><b>  </b>x<i> <u> </u></i></pre>', skip: :blank_text)
+      _(doc.at_css('pre').inner_html).must_equal '<b>  </b>x<i> <u> </u></i>'
+    end
+
+    it 'skips script and style content' do
+      doc = Nokolexbor::HTML(@html, skip: [:script_content])
+      _(doc.at_css('script').children.size).must_equal 0
+      _(doc.at_css('style').children.size).must_equal 0
+      _(doc.css('p').size).must_equal 0
+      _(doc.at_css('div').text).must_equal ' a  b '
+    end
+
+    it 'skips nodes while parsing in chunks' do
+      doc = Nokolexbor::HTML(StringIO.new(@html), skip: [:comments, :blank_text, :script_content])
+      _(doc.xpath('//comment()').size).must_equal 0
+      _(doc.at_css('script').children.size).must_equal 0
+      _(doc.at_css('div').children.map(&:name)).must_equal ['span', 'span']
+    end
+
+    it 'skips nodes when reparsing' do
+      doc = Nokolexbor::HTML('<!-- a -->')
+      doc.reparse(@html, skip: [:comments])
+      _(doc.xpath('//comment()').size).must_equal 0
+    end
+
+    it 'rejects unknown kinds' do
+      _ { Nokolexbor::HTML(@html, skip: [:divs]) }.must_raise ArgumentError
+    end
+  end
+end
@@ -0,0 +1,70 @@
+require 'spec_helper'
+
+describe Nokolexbor::Extractor do
+  before do
+    @doc = Nokolexbor::HTML <<-HTML
+      <div class="g" data-id="1">
+        <h3>First</h3>
+        <a href="/1">link</a>
+        <span class="VwiC3b">Snippet <b>one</b></span>
+        <ul><li>a</li><li>b</li></ul>
+      </div>
+      <div class="g" data-id="2">
+        <h3>Second</h3>
+        <a>no href</a>
+      </div>
+    HTML
+  end
+
+  it 'extracts text and attributes' do
+    result = @doc.at_css('div.g').extract(title: 'h3', url: 'a@href', snippet: '.VwiC3b')
+    _(result).must_equal({ title: 'First', url: '/1', snippet: 'Snippet one' })
+  end
+
+  it 'extracts attributes of the node itself' do
+    _(@doc.at_css('div.g').extract(id: '@data-id')).must_equal({ id: '1' })
+  end
+
+  it 'extracts all matches' do
+    _(@doc.at_css('div.g').extract(items: ['li'], missing: ['p'])).must_equal({ items: ['a', 'b'], missing: [] })
+  end
+
+  it 'returns nil for missing matches and attributes' do
+    result = @doc.css('div.g')[1].extract(url: 'a@href', snippet: '.VwiC3b')
+    _(result).must_equal({ url: nil, snippet: nil })
+  end
+
+  it 'takes the first match of a selector list in document order' do
+    _(@doc.at_css('div.g').extract(first: 'a, h3')).must_equal({ first: 'First' })
+  end
+
+  it 'extracts fields of every kind together' do
+    result = @doc.extract(
+      ids: ['div.g@data-id'], first: 'b, h3', links: ['div.g > a'], with_link: 'div.g:has(a[href])@data-id',
+      texts: ['li > ::text, b'], missing: 'section', itself: ['@lang']
+    )
+    _(result).must_equal({
+      ids: ['1', '2'], first: 'First', links: ['link', 'no href'], with_link: '1',
+      texts: ['one', 'a', 'b'], missing: nil, itself: [nil]
+    })
+    _(result.keys).must_equal [:ids, :first, :links, :with_link, :texts, :missing, :itself]
+  end
+
+  it 'keeps @ inside selectors' do
+    _(@doc.at_css('div.g').extract(url: 'a[href="/1"]@href')).must_equal({ url: '/1' })
+    _(Nokolexbor::HTML('<a title="a@b">x</a>').extract(a: 'a[title="a@b"]')).must_equal({ a: 'x' })
+  end
+
+  it 'extracts from every node of a NodeSet' do
+    extractor = Nokolexbor::Extractor.new(title: 'h3', id: '@data-id')
+    _(extractor).must_be :frozen?
+    _(@doc.css('div.g').extract(extractor)).must_equal [{ title: 'First', id: '1' }, { title: 'Second', id: '2' }]
+  end
+
+  it 'rejects invalid schemas' do
+    _ { Nokolexbor::Extractor.new('h3') }.must_raise ArgumentError
+    _ { Nokolexbor::Extractor.new(title: 1) }.must_raise ArgumentError
+    _ { Nokolexbor::Extractor.new(title: ['h3', 'h4']) }.must_raise ArgumentError
+    _ { Nokolexbor::Extractor.new(title: 'h3 >>') }.must_raise Nokolexbor::Lexbor::UnexpectedDataError
+  end
+end
@@ -11,6 +11,36 @@ describe "Multi threading" do
     end.each(&:join)
   end
 
+  it 'parses large documents concurrently' do
+    items = 5000.times.map { |i| "<li class='item'>#{i}</li>" }.join
+    10.times.map do |i|
+      Thread.new do
+        html = "<html><body><ul id='t#{i}'>#{items}</ul></body></html>"
+        _(html.bytesize).must_be :>, 64 * 1024
+        doc = Nokolexbor::HTML(html)
+        _(doc.at_css('ul')['id']).must_equal "t#{i}"
+        _(doc.css('li.item').size).must_equal 5000
+        _(doc.css('li.item').last.text).must_equal '4999'
+      end
+    end.each(&:join)
+  end
+
+  it 'parses many documents on worker threads' do
+    htmls = 200.times.map { |i| "<div id='d#{i}'>#{'<p>x</p>' * (i * 50)}</div>" }
+    htmls << StringIO.new('<span>io</span>')
+    htmls << '<b>中文</b>'.encode(Encoding::GBK)
+    docs = Nokolexbor.parse_many(htmls, threads: 4)
+    _(docs.size).must_equal 202
+    200.times do |i|
+      _(docs[i].at_css('div')['id']).must_equal "d#{i}"
+      _(docs[i].css('p').size).must_equal i * 50
+    end
+    _(docs[200].at_css('span').text).must_equal 'io'
+    _(docs[201].at_css('b').text).must_equal '中文'
+    _(Nokolexbor.parse_many([], threads: 4)).must_equal []
+    _ { Nokolexbor.parse_many(['<div>'], threads: 0) }.must_raise ArgumentError
+  end
+
   it 'returns correct results under concurrent access with diverse selectors' do
     num_threads = 100
     iterations = 50
@@ -1,4 +1,5 @@
 require 'spec_helper'
+require 'objspace'
 
 describe Nokolexbor::NodeSet do
   before do
@@ -116,6 +117,29 @@ describe Nokolexbor::NodeSet do
     _(@nodes.include?(Nokolexbor::Node.new('div', @nodes[0].document))).must_equal false
   end
 
+  it 'keeps large sets unique' do
+    doc = Nokolexbor::HTML('<div><span></span><a></a></div>' * 100)
+    nodes = doc.css('div, span, div > span, a')
+    _(nodes.size).must_equal 300
+    _(nodes.css('span, span').size).must_equal 100
+
+    set = Nokolexbor::NodeSet.new(doc, nodes.to_a + nodes.to_a)
+    _(set.size).must_equal 300
+    last = set.last
+    _(set.delete(last)).must_equal last
+    _(set.include?(last)).must_equal false
+    _(set.delete(last)).must_be_nil
+    set << last << last
+    _(set.size).must_equal 300
+    _(set.include?(last)).must_equal true
+    _((set | doc.css('div')).size).must_equal 300
+  end
+
+  it 'reports its native memory size' do
+    doc = Nokolexbor::HTML('<p></p>' * 1000)
+    _(ObjectSpace.memsize_of(doc.css('p'))).must_be :>=, 1000 * 8
+  end
+
   it 'is enumerable' do
     _(@nodes.map {|n| n['class']}.join).must_equal 'abcdef'
   end
@@ -438,4 +462,4 @@ HTML
       _(@doc.at_css('div').inner_html).must_equal '<a class="a" href="http://example.com"></a><a class="c" style="d" href="http://example.com"></a>'
     end
   end
-end
\ No newline at end of file
+end
@@ -111,6 +111,45 @@ describe Nokolexbor::Node do
       _(nodes[3]['class']).must_equal 'a'
     end
 
+    it 'results are in document traversal order after the tree is changed' do
+      _(@root.css('div, a').map(&:name)).must_equal ['a', 'div']
+      @root.at_css('div.a').add_previous_sibling(@root.at_css('h1.top'))
+      @root.prepend_child('<p>first</p><span>second</span>')
+      @root.add_child('<p>last</p>')
+      _(@root.css('span, div, p, a').map(&:name)).must_equal ['p', 'span', 'a', 'div', 'p']
+      _(@root.xpath('.//p | .//span | .//a | .//div').map(&:name)).must_equal ['p', 'span', 'a', 'div', 'p']
+
+      # Runs out of room between the keys of two nodes, the document is then renumbered
+      20.times { |i| @root.at_css('div.a').add_next_sibling("<b>#{i}</b>") }
+      _(@root.css('p, b, div').map { |node| node.name == 'b' ? node.text : node.name })
+        .must_equal ['p', 'div', *(0...20).map(&:to_s).reverse, 'p']
+    end
+
+    it 'results are in document traversal order in detached trees' do
+      @root.unlink
+      @root.add_child('<p>last</p>')
+      @root.at_css('div.a').add_previous_sibling(@root.at_css('a'))
+      _(@root.css('p, div, a, h1').map(&:name)).must_equal ['h1', 'a', 'h1', 'div', 'p']
+    end
+
+    it 'results of lists are the union of their selectors in document traversal order' do
+      all = @root.css('*').to_a
+      [
+        '> h1, a',
+        'a > h1, div.a',
+        'h1 + div, a',
+        'h1 ~ div, h1 h1',
+        'h1:not(.top), div',
+        'div:has(h1), a',
+      ].each do |selector|
+        expected = selector.split(', ').flat_map { |part| @root.css(part).to_a }.uniq.sort_by { |node| all.index(node) }
+        _(@root.css(selector).to_a).must_equal expected
+        _(@root.at_css(selector)).must_equal expected.first
+        _(@root.css_count(selector)).must_equal expected.size
+      end
+      _(@root.css('h1, ::text').size).must_equal(2 + @root.css('::text').size)
+    end
+
     it 'supports top level relative selector' do
       nodes = @root.css('> h1')
       _(nodes.size).must_equal 1
@@ -160,6 +199,81 @@ describe Nokolexbor::Node do
     end
   end
 
+  describe 'css_count and css_any?' do
+    before do
+      @doc = Nokolexbor::HTML <<-HTML
+        <div class="a">
+          <div class="b"><span>1</span><span class="c">2</span></div>
+        </div>
+        <p>3</p>
+      HTML
+    end
+
+    it 'counts the matches' do
+      _(@doc.css_count('span')).must_equal 2
+      _(@doc.css_count('div span')).must_equal 2
+      _(@doc.css_count('div > span, span.c, p')).must_equal 3
+      _(@doc.css_count(Nokolexbor::Selector.new('span, .c'))).must_equal 2
+      _(@doc.css_count('section')).must_equal 0
+      _(@doc.at_css('div.b').css_count('span')).must_equal 2
+    end
+
+    it 'counts like css' do
+      ['div', 'div div', 'div span', 'body *', 'span ~ span', 'div, div.a, span'].each do |selector|
+        _(@doc.css_count(selector)).must_equal @doc.css(selector).size
+      end
+    end
+
+    it 'tells whether anything matches' do
+      _(@doc.css_any?('span.c')).must_equal true
+      _(@doc.css_any?('section, p')).must_equal true
+      _(@doc.css_any?('section')).must_equal false
+      _(@doc.at_css('p').css_any?('span')).must_equal false
+    end
+
+    it 'raises on invalid selectors' do
+      _ { @doc.css_count('div >>') }.must_raise Nokolexbor::Lexbor::UnexpectedDataError
+      _ { @doc.css_any?('div >>') }.must_raise Nokolexbor::Lexbor::UnexpectedDataError
+    end
+  end
+
+  describe 'css_text, css_attr and at_css_text' do
+    before do
+      @doc = Nokolexbor::HTML <<-HTML
+        <ul>
+          <li><a href="/1">One <b>1</b></a></li>
+          <li><a>Two</a></li>
+          <li><a href="/3">Three</a></li>
+        </ul>
+      HTML
+    end
+
+    it 'returns the text of the matches' do
+      _(@doc.css_text('a')).must_equal ['One 1', 'Two', 'Three']
+      _(@doc.css_text('b', 'li > a[href="/3"]')).must_equal ['1', 'Three']
+      _(@doc.css_text('p')).must_equal []
+    end
+
+    it 'returns the attribute of the matches' do
+      _(@doc.css_attr('a', 'href')).must_equal ['/1', nil, '/3']
+      _(@doc.css_attr(Nokolexbor::Selector.new('a'), :href)).must_equal ['/1', nil, '/3']
+    end
+
+    it 'returns the text of the first match' do
+      _(@doc.at_css_text('li a')).must_equal 'One 1'
+      _(@doc.at_css('li:nth-child(2)').at_css_text('a')).must_equal 'Two'
+      _(@doc.at_css_text('p')).must_be_nil
+    end
+
+    it 'works with the css cache' do
+      @doc.css_cache = true
+      2.times do
+        _(@doc.css_text('a')).must_equal ['One 1', 'Two', 'Three']
+        _(@doc.at_css_text('a')).must_equal 'One 1'
+      end
+    end
+  end
+
   describe 'inner_html' do
     it 'with indent' do
       doc = Nokolexbor::HTML('<span><div><div class="a"></div></div></span>')
@@ -815,6 +929,35 @@ HTML
     _(node.map {|k, v| v}.join).must_equal '123'
   end
 
+  it 'returns the same object for the same node' do
+    doc = Nokolexbor::HTML('<div id="a"><span>1</span><span>2</span></div>')
+    div = doc.at_css('div')
+    _(div).must_be_same_as doc.at_css('#a')
+    _(div.children.first).must_be_same_as div.child
+    _(div.child.parent).must_be_same_as div
+    _(doc.css('span').last).must_be_same_as div.child.next
+    _(div.attribute('id')).must_be_same_as div.attribute_nodes.first
+
+    span = div.child
+    span.destroy
+    _(div.child.text).must_equal '2'
+    _ { span.text }.must_raise RuntimeError
+
+    id = div.attribute('id')
+    div.remove_attr('id')
+    _ { id.value }.must_raise RuntimeError
+  end
+
+  it 'keeps its document alive without instance variables' do
+    div = Nokolexbor::HTML('<div><span>1</span></div>').at_css('div')
+    GC.start
+    GC.compact if GC.respond_to?(:compact)
+    _(div.document).must_be_kind_of Nokolexbor::Document
+    _(div.child.document).must_be_same_as div.document
+    _(div.instance_variables).must_equal []
+    _(div == div.document.css('div')).must_equal false
+  end
+
   describe 'xpath' do
     before do
       @doc = Nokolexbor::HTML <<-HTML
@@ -852,6 +995,54 @@ HTML
       _{ @root.xpath('.//text1()') }.must_raise Nokolexbor::XPath::SyntaxError
     end
 
+    it 'returns the same results for repeated queries' do
+      3.times do
+        _(@root.xpath('.//h1[@class="inner"]').size).must_equal 1
+        _(@root.at_xpath('.//h1').name).must_equal 'h1'
+      end
+    end
+
+    it 'returns the same results for repeated streamable queries' do
+      2.times do
+        _(@root.xpath('.//h1').size).must_equal 2
+        _(@doc.xpath('//div').size).must_equal 2
+      end
+    end
+
+    it 'works with compiled expressions' do
+      expr = Nokolexbor::XPath.compile('.//h1')
+      _(expr.source).must_equal './/h1'
+      _(@root.xpath(expr).size).must_equal 2
+      _(@root.at_xpath(expr)['class']).must_equal 'top'
+      _(@doc.at_css('h1.top').xpath(expr).size).must_equal 1
+      _(Nokolexbor::HTML('<h1></h1>').xpath(expr).size).must_equal 1
+    end
+
+    it 'reuses the context across documents, positions and variables' do
+      other = Nokolexbor::HTML('<h1 class="x"></h1><h1 class="y"></h1><h1 class="z"></h1>')
+      _(@root.xpath('.//h1[last()]')[0]['class']).must_equal 'inner'
+      _(other.xpath('//h1[last()]')[0]['class']).must_equal 'z'
+      _(other.xpath('//h1[@class=$c]', nil, { c: 'y' }).size).must_equal 1
+      _(@root.xpath('count(.//h1)')).must_equal 2.0
+      _(@root.xpath('.//h1[nokogiri-builtin:css-class(@class, "top")]').size).must_equal 1
+    end
+
+    it 'matches element and attribute names exactly' do
+      doc = Nokolexbor::HTML('<div class="a" data-x="1"><my-tag id="b"></my-tag><p></p></div><div></div>')
+      _(doc.xpath('//div[@class]').size).must_equal 1
+      _(doc.xpath('//div').size).must_equal 2
+      _(doc.xpath('//DIV').size).must_equal 0
+      _(doc.xpath('//@data-x').size).must_equal 1
+      _(doc.xpath('//div/@CLASS').size).must_equal 0
+      _(doc.xpath('//my-tag/@id').first.value).must_equal 'b'
+      _(doc.xpath('//div/*[self::p or self::my-tag]').size).must_equal 2
+      _(doc.xpath('//unknown').size).must_equal 0
+    end
+
+    it 'raises if compiled expression is invalid' do
+      _{ Nokolexbor::XPath.compile('.//h1[') }.must_raise Nokolexbor::XPath::SyntaxError
+    end
+
     it 'preceding axis from attribute node does not crash' do
       doc = Nokolexbor::HTML('<html><body><a>x</a><b id="y">y</b></body></html>')
       result = doc.xpath('//@id[preceding::*]')
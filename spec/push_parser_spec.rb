@@ -0,0 +1,59 @@
+require 'spec_helper'
+
+describe Nokolexbor::PushParser do
+  before do
+    @html = '<html><head><title>你好</title><meta name="a" content="b"></head><body><div class="x">1</div><p>2</p></body></html>'
+    @parser = Nokolexbor::PushParser.new
+  end
+
+  it 'builds the same document as parse' do
+    @html.b.chars.each_slice(3) { |bytes| @parser << bytes.join }
+    doc = @parser.finish
+    _(doc).must_be_same_as @parser.document
+    _(doc.to_html).must_equal Nokolexbor::HTML(@html).to_html
+    _(doc.at_css('p').source_location).must_equal @html.b.index('p>2')
+    _(@parser.finished?).must_equal true
+  end
+
+  it 'allows searching the partial document' do
+    @parser << @html[0, @html.index('<body>')]
+    _(@parser.document.at_css('title').text).must_equal '你好'
+    _(@parser.document.at_css('meta')['content']).must_equal 'b'
+    _(@parser.document.at_css('div')).must_be_nil
+
+    @parser.write(@html[@html.index('<body>')..], true)
+    _(@parser.finished?).must_equal true
+    _(@parser.document.at_css('div.x').text).must_equal '1'
+  end
+
+  it 'parses the chunks held back when finishing' do
+    @parser << '<p>hi</p>'.b
+    _(@parser.finish.to_html).must_equal Nokolexbor::HTML('<p>hi</p>').to_html
+  end
+
+  it 'keeps the chunks held back to detect the encoding' do
+    @parser << '<p>a'.b
+    @parser.write('b</p>'.b, true)
+    _(@parser.document.at_css('p').text).must_equal 'ab'
+
+    parser = Nokolexbor::PushParser.new
+    parser << '<p>é'.encode('ISO-8859-1').b
+    parser << '</p><p>é</p>'.encode('ISO-8859-1')
+    _(parser.finish.css('p').map(&:text)).must_equal ['é', 'é']
+  end
+
+  it 'does not allow destroying nodes while parsing' do
+    @parser << '<div><span>1</span>'
+    span = @parser.document.at_css('span')
+    _ { span.destroy }.must_raise RuntimeError
+    _ { @parser.document.at_css('div').add_child('<b></b>') }.must_raise RuntimeError
+    @parser.finish
+    span.destroy
+    _(@parser.document.at_css('div').inner_html).must_equal ''
+  end
+
+  it 'raises when writing after finish' do
+    @parser.finish
+    _ { @parser << '<div></div>' }.must_raise RuntimeError
+  end
+end
@@ -0,0 +1,60 @@
+require 'spec_helper'
+
+describe Nokolexbor::Selector do
+  before do
+    @doc = Nokolexbor::HTML <<-HTML
+      <section>
+        <div class='a'><span>A</span></div>
+        <div class='b'>B</div>
+        <h1><a></a></h1>
+      </section>
+    HTML
+  end
+
+  it 'keeps its source' do
+    selector = Nokolexbor::Selector.new('div.a')
+    _(selector.source).must_equal 'div.a'
+    _(selector.to_s).must_equal 'div.a'
+    _(selector).must_be :frozen?
+  end
+
+  it 'raises on invalid syntax' do
+    _{ Nokolexbor::Selector.new('div >>') }.must_raise Nokolexbor::Lexbor::UnexpectedDataError
+  end
+
+  it 'works with css and at_css' do
+    selector = Nokolexbor::Selector.new('div')
+    3.times do
+      _(@doc.css(selector).size).must_equal 2
+      _(@doc.at_css(selector)['class']).must_equal 'a'
+    end
+  end
+
+  it 'sorts results of selector lists in document traversal order' do
+    nodes = @doc.css(Nokolexbor::Selector.new('a, h1, div.a'))
+    _(nodes.map(&:name)).must_equal ['div', 'h1', 'a']
+  end
+
+  it 'works with matches?' do
+    node = @doc.at_css('span')
+    _(node.matches?(Nokolexbor::Selector.new('div.a > span'))).must_equal true
+    _(node.matches?(Nokolexbor::Selector.new('div.b > span'))).must_equal false
+  end
+
+  it 'works with NodeSet#css and NodeSet#at_css' do
+    nodes = @doc.css('div')
+    selector = Nokolexbor::Selector.new('span')
+    _(nodes.css(selector).text).must_equal 'A'
+    _(nodes.at_css(selector).text).must_equal 'A'
+  end
+
+  it 'can be shared between threads' do
+    selector = Nokolexbor::Selector.new('.c')
+    10.times.map do |i|
+      Thread.new do
+        doc = Nokolexbor::HTML("<div class='c'>#{i}</div>")
+        _(doc.at_css(selector).text).must_equal i.to_s
+      end
+    end.each(&:join)
+  end
+end